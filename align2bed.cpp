@@ -22,42 +22,332 @@
  * \author Anthony J. Greenberg
  *
  * Extracting SNPs from the DPGP .seq files. The variant table will be in the _plink_ BED format. Each chromosome is processed by its own thread in parallel.
+ * A position index (_.bpi_) is saved with each BED file. Run as
+ *
+ *     align2bed query snp_Chr2L.bpi Chr2L:5000000-5200000
+ *
+ * to get the rows and byte ranges of the SNPs in a region without reading the _.bim_ file.
+ *
+ * Whole-genome runs can be spread over separate processes. Each process runs
+ *
+ *     align2bed --shard i/k
+ *
+ * to convert slice _i_ (0-based) of _k_ of every chromosome into BED fragments. The fragments are then combined with
+ *
+ *     align2bed merge out.bed fragment1.bed fragment2.bed ...
+ *
+ * which also indexes the merged file. Alternatively,
+ *
+ *     align2bed --genome
+ *
+ * saves all chromosomes to a single indexed data set (_snp_genome.bed_, _.bim_ and _.fam_) in one run.
+ *
+ * Except for genome-wide runs, progress is checkpointed after each chunk. If a run is interrupted, running the same command again continues from the last checkpoint.
+ * Running
+ *
+ *     align2bed --incremental
+ *
+ * saves a site summary with each chromosome. After new lines are appended to the _seqList_ files, the same command updates the BED files reading only the new _.seq_ files.
+ * Repeated extractions can be served from memory. Run
+ *
+ *     align2bed serve /tmp/a2b.sock
+ *
+ * to map the alignments of all chromosomes and listen on a Unix domain socket. Then
+ *
+ *     align2bed client /tmp/a2b.sock Chr2L:5000000-5200000 [line1,line2,...] out
+ *
+ * saves the SNPs in the region, called among the listed lines (all if no list is given), to _out.bed_, _out.bim_ and _out.fam_. The request _align2bed client /tmp/a2b.sock shutdown_ stops the server.
+ *
+ * With _--dedup W_, each distinct BED row is saved once (_.dbed_ file) together with a pattern index (_.pid_ file), matching rows within windows of _W_ SNPs. Run
+ *
+ *     align2bed expand snp_Chr2L
+ *
+ * to restore the ordinary _snp_Chr2L.bed_ and save its _.bpi_ index.
+ *
+ * The _--windows W/S_ option saves diversity and missingness summaries in windows of _W_ bases starting every _S_ bases (_--windows W_ for non-overlapping windows) to a _.win_ table next to each output file, collected in the same pass as the conversion.
+ *
+ * The _--vcf_ option saves each chromosome as a VCF file instead (_snp_Chr2L.vcf_ etc.), and _--bgzf_ compresses the VCF files in the BGZF format (if compiled with _USE_ZLIB_).
+ * The _.seq_ files may be gzip or BGZF compressed (if compiled with _USE_ZLIB_); list the compressed names, e.g. _seqs/L000_Chr2L.seq.gz_, in the _seqList_ files.
+ * With the _--numa_ option, the chromosome threads are spread over the NUMA nodes and pinned to the CPUs of their node, and the input throughput of each node is reported at the end of the run.
  */
 
 #include "sequence.hpp"
 #include <vector>
 #include <string>
 #include <thread>
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
 
 
 using std::vector;
 using std::string;
 using std::thread;
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::max;
+using std::to_string;
+using std::chrono::steady_clock;
+using std::chrono::duration;
 
-int main(){
-	
+/** \brief Parse a genome region
+ *
+ * Parses a region in the _chrom:start-end_ format, allowing commas in the positions (e.g., _Chr2L:5,000,000-6,000,000_). Exits with an error if the region is malformed.
+ *
+ * \param[in] region region string
+ * \param[out] chrom chromosome name
+ * \param[out] start start position
+ * \param[out] end end position
+ */
+static void parseRegion(const string &region, string &chrom, unsigned long &start, unsigned long &end){
+	string cleanRegion;
+	for (auto rIt = region.begin(); rIt != region.end(); ++rIt) {
+		if (*rIt != ',') { // allow 5,000,000-style positions
+			cleanRegion += *rIt;
+		}
+	}
+	const size_t colPos  = cleanRegion.rfind(':');
+	const size_t dashPos = (colPos == string::npos ? string::npos : cleanRegion.find('-', colPos));
+	if ( (colPos == string::npos) || (colPos == 0) || (dashPos == string::npos) ) {
+		cerr << "ERROR: region " << region << " not in chrom:start-end format" << endl;
+		exit(1);
+	}
+	const string startStr = cleanRegion.substr(colPos + 1, dashPos - colPos - 1);
+	const string endStr   = cleanRegion.substr(dashPos + 1);
+	if ( startStr.empty() || endStr.empty() || (startStr.find_first_not_of("0123456789") != string::npos) || (endStr.find_first_not_of("0123456789") != string::npos) ) {
+		cerr << "ERROR: positions in region " << region << " must be non-negative integers" << endl;
+		exit(1);
+	}
+	chrom = cleanRegion.substr(0, colPos);
+	start = strtoul(startStr.c_str(), nullptr, 10);
+	end   = strtoul(endStr.c_str(), nullptr, 10);
+	if (start > end) {
+		cerr << "ERROR: start of region " << region << " is past its end" << endl;
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[]){
 	vector<string> chromIDs {"Chr2L", "Chr2R", "Chr3L", "Chr3R", "ChrX"}; // chromosome IDs
 	vector<unsigned short> chromNums {2, 3, 4, 5, 1};                     // chromosome numbers (needed for the BED metadata)
+	
+	if ( (argc > 1) && (string(argv[1]) == "query") ) {
+		if (argc != 4) {
+			cerr << "Usage: align2bed query index.bpi chrom:start-end" << endl;
+			exit(1);
+		}
+		string chrom;
+		unsigned long start = 0;
+		unsigned long end   = 0;
+		parseRegion(argv[3], chrom, start, end);
+		
+		BEDindex bedIdx(argv[2]);
+		BEDrange range = bedIdx.query(chrom, start, end);
+		cout << "rows\t" << range.firstRow << "\t" << range.nRows << endl;
+		cout << "bed\t" << range.bedBegin << "\t" << range.bedEnd << endl;
+		cout << "bim\t" << range.bimBegin << "\t" << range.bimEnd << endl;
+		
+		return 0;
+	}
+	if ( (argc > 1) && (string(argv[1]) == "merge") ) {
+		if (argc < 4) {
+			cerr << "Usage: align2bed merge out.bed fragment1.bed fragment2.bed ..." << endl;
+			exit(1);
+		}
+		const vector<string> fragNames(argv + 3, argv + argc);
+		string outBase(argv[2]);
+		if ( (outBase.size() > 4) && (outBase.compare(outBase.size() - 4, 4, ".bed") == 0) ) {
+			outBase.erase(outBase.size() - 4);
+		}
+		mergeShards(fragNames, outBase + ".bed");
+		BEDindex bedIdx(outBase + ".bim", outBase + ".fam");
+		bedIdx.save(outBase + ".bpi");
+		
+		return 0;
+	}
+	if ( (argc > 1) && (string(argv[1]) == "expand") ) {
+		if (argc != 3) {
+			cerr << "Usage: align2bed expand outBase" << endl;
+			exit(1);
+		}
+		const string outBase(argv[2]);
+		BEDpatterns patterns(outBase + ".dbed", outBase + ".pid");
+		patterns.expand(outBase + ".bed");
+		BEDindex bedIdx(outBase + ".bim", outBase + ".fam");
+		bedIdx.save(outBase + ".bpi");
+		cout << patterns.nSNP() << " SNPs from " << patterns.nPatterns() << " patterns saved to " << outBase << ".bed" << endl;
+		
+		return 0;
+	}
+	if ( (argc > 1) && (string(argv[1]) == "serve") ) {
+		if (argc != 3) {
+			cerr << "Usage: align2bed serve socket" << endl;
+			exit(1);
+		}
+		vector<SFparse> parsers;
+		for (size_t iChr = 0; iChr < chromIDs.size(); iChr++) {
+			parsers.push_back(SFparse("seqList_" + chromIDs[iChr] + ".txt", "snp_" + chromIDs[iChr] + ".bed", chromIDs[iChr], chromNums[iChr], "SEQ", "BED"));
+		}
+		SNPserver server(parsers);
+		server.serve(argv[2]);
+		
+		return 0;
+	}
+	if ( (argc > 1) && (string(argv[1]) == "client") ) {
+		if ( (argc == 4) && (string(argv[3]) == "shutdown") ) {
+			requestSNPs(argv[2], "shutdown", "");
+			return 0;
+		}
+		if ( (argc != 5) && (argc != 6) ) {
+			cerr << "Usage: align2bed client socket chrom:start-end [line1,line2,...] outBase" << endl;
+			cerr << "       align2bed client socket shutdown" << endl;
+			exit(1);
+		}
+		string chrom;
+		unsigned long start = 0;
+		unsigned long end   = 0;
+		parseRegion(argv[3], chrom, start, end);
+		string request = "region " + chrom + " " + to_string(start) + " " + to_string(end);
+		if (argc == 6) {
+			request += " " + string(argv[4]);
+		}
+		const uint64_t nSNP = requestSNPs(argv[2], request, argv[argc - 1]);
+		cout << nSNP << " SNPs saved to " << argv[argc - 1] << ".bed" << endl;
+		
+		return 0;
+	}
+	
+	unsigned int shard   = 0;
+	unsigned int nShards = 1;
+	bool sharded         = false;
+	bool genomeWide      = false;
+	bool incremental     = false;
+	bool useNUMA         = false;
+	string outType       = "BED";
+	bool bgzf            = false;
+	uint32_t dedupWindow = 0;
+	uint32_t winSize     = 0;
+	uint32_t winStep     = 0;
+	for (int iArg = 1; iArg < argc; iArg++) {
+		const string arg(argv[iArg]);
+		if ( (arg == "--shard") && (iArg + 1 < argc) ) {
+			const string shardSpec(argv[++iArg]);
+			const size_t slashPos = shardSpec.find('/');
+			if (slashPos == string::npos) {
+				cerr << "ERROR: shard specification " << shardSpec << " not in i/k format" << endl;
+				exit(1);
+			}
+			const string shardStr  = shardSpec.substr(0, slashPos);
+			const string nShardStr = shardSpec.substr(slashPos + 1);
+			if ( shardStr.empty() || nShardStr.empty() || (shardStr.find_first_not_of("0123456789") != string::npos) || (nShardStr.find_first_not_of("0123456789") != string::npos) ) {
+				cerr << "ERROR: shard specification " << shardSpec << " must be two non-negative integers" << endl;
+				exit(1);
+			}
+			shard   = strtoul(shardStr.c_str(), nullptr, 10);
+			nShards = strtoul(nShardStr.c_str(), nullptr, 10);
+			sharded = true;
+		} else if ( (arg == "--dedup") && (iArg + 1 < argc) ) {
+			dedupWindow = strtoul(argv[++iArg], nullptr, 10);
+			if (dedupWindow == 0) {
+				cerr << "ERROR: --dedup window must be a positive number of SNPs" << endl;
+				exit(1);
+			}
+		} else if ( (arg == "--windows") && (iArg + 1 < argc) ) {
+			const string winSpec(argv[++iArg]);
+			const size_t slashPos = winSpec.find('/');
+			winSize = strtoul(winSpec.substr(0, slashPos).c_str(), nullptr, 10);
+			winStep = (slashPos == string::npos ? winSize : strtoul(winSpec.substr(slashPos + 1).c_str(), nullptr, 10));
+			if ( (winSize == 0) || (winStep == 0) || (winSize % winStep) ) {
+				cerr << "ERROR: window specification " << winSpec << " must be W or W/S, with W a multiple of S" << endl;
+				exit(1);
+			}
+		} else if (arg == "--genome") {
+			genomeWide = true;
+		} else if (arg == "--incremental") {
+			incremental = true;
+		} else if (arg == "--numa") {
+			useNUMA = true;
+		} else if (arg == "--vcf") {
+			outType = "VCF";
+		} else if (arg == "--bgzf") {
+#ifndef USE_ZLIB
+			cerr << "ERROR: --bgzf requires compiling with USE_ZLIB" << endl;
+			exit(1);
+#endif
+			outType = "VCF";
+			bgzf    = true;
+		} else {
+			cerr << "ERROR: unknown option " << arg << endl;
+			exit(1);
+		}
+	}
+	if (genomeWide && (nShards > 1) ) {
+		cerr << "ERROR: --genome and --shard cannot be combined; merge the shards instead" << endl;
+		exit(1);
+	}
+	if ( incremental && (nShards > 1) ) {
+		cerr << "ERROR: --incremental and --shard cannot be combined" << endl;
+		exit(1);
+	}
+	if ( (outType == "VCF") && ( genomeWide || incremental || (nShards > 1) || dedupWindow ) ) {
+		cerr << "ERROR: --genome, --incremental, --shard and --dedup are only available for BED output" << endl;
+		exit(1);
+	}
+	if ( winSize && ( incremental || (nShards > 1) ) ) {
+		cerr << "ERROR: --windows cannot be combined with --incremental or --shard" << endl;
+		exit(1);
+	}
+	if ( dedupWindow && ( genomeWide || incremental || (nShards > 1) ) ) {
+		cerr << "ERROR: --dedup cannot be combined with --genome, --incremental or --shard" << endl;
+		exit(1);
+	}
+	
 	vector<thread> threads(4); // main thread will do the X
+	vector<SFparse> parsers;   // kept after the threads are done for genome-wide output
+	parsers.reserve(chromIDs.size());
+	const unsigned int nZipThreads = (bgzf ? max(thread::hardware_concurrency()/static_cast<unsigned int>( chromIDs.size() ), 1U) : 0); // BGZF threads per chromosome
+	NUMAlayout numa;
+	vector<double> seconds(chromIDs.size(), 0.0); // run time of each chromosome
+	
+	// chromosome i goes to NUMA node i modulo the number of nodes; pinning before the run means the chunk buffers are first touched on that node
+	auto runParser = [&parsers, &numa, &seconds, useNUMA](const size_t iPrs){
+		if ( useNUMA && !numa.pin(iPrs % numa.nNodes()) ) {
+			cerr << "WARNING: unable to pin the thread for chromosome " << iPrs << " to NUMA node " << numa.nodeID(iPrs % numa.nNodes()) << endl;
+		}
+		const steady_clock::time_point start = steady_clock::now();
+		parsers[iPrs]();
+		seconds[iPrs] = duration<double>(steady_clock::now() - start).count();
+		if (useNUMA) {
+			numa.unpin(); // the X runs on the main thread, and threads it starts later (e.g., for genome-wide output) must not inherit the node
+		}
+	};
 	
-	auto chrIt  = chromIDs.begin();
-	auto chrNit = chromNums.begin();
-	auto thrIt  = threads.begin();
+	// all parsers are constructed, so every input file passes the preflight checks, before any conversion starts
+	for (size_t iChr = 0; iChr < chromIDs.size(); iChr++) {
+		const string inFlList = "seqList_" + chromIDs[iChr] + ".txt";
+		const string outFl    = "snp_" + chromIDs[iChr] + ".bed";
+		parsers.push_back(SFparse(inFlList, outFl, chromIDs[iChr], chromNums[iChr], "SEQ", outType));
+		parsers.back().indexOutput(true);
+		parsers.back().genomeWide(genomeWide);
+		parsers.back().checkpoint(!genomeWide);
+		parsers.back().incremental(incremental);
+		parsers.back().compressVCF(nZipThreads);
+		parsers.back().dedupBED(dedupWindow);
+		parsers.back().windowStats(winSize, winStep);
+		if (sharded) {
+			parsers.back().setShard(shard, nShards); // range-checks the specification
+		}
+	}
 	
-	for (; thrIt != threads.end(); ++thrIt, ++chrIt, ++chrNit) {
-		const string inFlList = "seqList_" + (*chrIt) + ".txt";
-		const string outFl    = "snp_" + (*chrIt) + ".bed";
-		// parsing the autosomes
-		SFparse parseA(inFlList, outFl, *chrIt, *chrNit, "SEQ", "BED");
-		
-		(*thrIt) = thread(parseA);
+	// parsing the autosomes; the X is last in the list
+	for (size_t iThr = 0; iThr < threads.size(); iThr++) {
+		threads[iThr] = thread(runParser, iThr);
 	}
-	const string inFlList("seqList_ChrX.txt");
-	const string outFl("snp_ChrX.bed");
 	
 	// parsing the X
-	SFparse parseX(inFlList, outFl, "ChrX", 1, "SEQ", "BED");
-	parseX();
+	runParser(parsers.size() - 1);
 	
 	for (auto thrdIt = threads.begin(); thrdIt != threads.end(); ++thrdIt) {
 		if (thrdIt->joinable()) {
@@ -65,5 +355,25 @@ int main(){
 		}
 	}
 	
+	if (useNUMA) {
+		vector<double> nodeMB(numa.nNodes(), 0.0);
+		vector<double> nodeSeconds(numa.nNodes(), 0.0);
+		for (size_t iPrs = 0; iPrs < parsers.size(); iPrs++) {
+			const size_t iNode  = iPrs % numa.nNodes();
+			nodeMB[iNode]      += static_cast<double>( parsers[iPrs].inputSize() )/1048576.0;
+			nodeSeconds[iNode]  = max(nodeSeconds[iNode], seconds[iPrs]);
+		}
+		for (size_t iNode = 0; iNode < numa.nNodes(); iNode++) {
+			if (nodeSeconds[iNode] > 0.0) {
+				cout << "NUMA node " << numa.nodeID(iNode) << ": " << nodeMB[iNode] << " MB in " << nodeSeconds[iNode] << " s (" << nodeMB[iNode]/nodeSeconds[iNode] << " MB/s)" << endl;
+			}
+		}
+	}
+	
+	if (genomeWide) {
+		saveGenomeBED(parsers, "snp_genome.bed");
+		BEDindex bedIdx("snp_genome.bim", "snp_genome.fam");
+		bedIdx.save("snp_genome.bpi");
+	}
 	
 }
@@ -32,9 +32,44 @@
 #include <unordered_map>
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <fstream>
 #include <limits>
 #include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef USE_LIBNUMA
+#include <numa.h>
+#endif
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
 
 using std::vector;
 using std::unordered_map;
@@ -45,217 +80,1565 @@ using std::endl;
 using std::flush;
 using std::ofstream;
 using std::ifstream;
+using std::ostream;
+using std::thread;
+using std::atomic;
+using std::mutex;
+using std::unique_lock;
+using std::condition_variable;
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
 using std::ios;
 using std::numeric_limits;
 using std::ceil;
+using std::lower_bound;
+using std::upper_bound;
+using std::sort;
+using std::to_string;
+using std::istreambuf_iterator;
+using std::streamsize;
+using std::fill;
+using std::find;
+using std::istringstream;
 
-SFparse::SFparse(const vector<string> &inFlNam, const vector<string> &lineNames, const string &refFlNam, const string &outFlNam, const string &chrNam, const unsigned short &chrNum, const string &inFlType, const string &outFlType, const unsigned long &alloc) : _inFileNames(inFlNam), _lineNames(lineNames), _refFlName(refFlNam), _outFileName(outFlNam), _chromName(chrNam), _chromNum(chrNum), _inFileType(inFlType), _outFileType(outFlType), _bufAlloc(alloc) {
-	auto outIt = _outFileName.end();
-	if ( *(outIt - 4) == '.') { // there is a potentially valid extension
-		_outFileName.erase(outIt - 4, outIt); // erase the extension
+/** \brief Conversion checkpoint
+ *
+ * State of a BED conversion after a completed chunk.
+ */
+struct Checkpoint {
+	/// Hash of the inputs
+	uint64_t inputHash;
+	/// Zero-based offset of the next site to process
+	uint64_t nextOffset;
+	/// Number of SNPs saved
+	uint64_t nSNP;
+	/// Length of the _.bed_ file
+	uint64_t bedLength;
+	/// Length of the _.bim_ file
+	uint64_t bimLength;
+};
+
+/** \brief Load a checkpoint
+ *
+ * \param[in] ckptName checkpoint file name
+ * \param[out] ckpt checkpoint
+ *
+ * \return _true_ if a valid checkpoint was read
+ */
+static bool loadCheckpoint(const string &ckptName, Checkpoint &ckpt){
+	ifstream ckptIn(ckptName.c_str(), ios::binary);
+	if (!ckptIn) {
+		return false;
 	}
+	char tag[4];
+	uint32_t version = 0;
+	ckptIn.read(tag, 4);
+	ckptIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	ckptIn.read(reinterpret_cast<char*>(&ckpt), sizeof(Checkpoint));
+	
+	return ckptIn && (string(tag, 4) == "A2BC") && (version == 1);
 }
 
-SFparse::SFparse(const string &fileList, const string &outFlNam, const string &chrNam, const unsigned short &chrNum, const string &inFlType, const string &outFlType, const unsigned long &alloc) : _outFileName(outFlNam), _chromName(chrNam), _chromNum(chrNum), _inFileType(inFlType), _outFileType(outFlType), _bufAlloc(alloc) {
-	auto outIt = _outFileName.end();
-	if ( *(outIt - 4) == '.') { // there is a potentially valid extension
-		_outFileName.erase(outIt - 4, outIt); // erase the extension
+/** \brief Flush a file to disk
+ *
+ * Output streams only hand their data to the operating system; _fsync()_ makes sure it survives a crash of the node. Synchronizing a directory makes a rename in it durable.
+ *
+ * \param[in] flName file or directory name
+ */
+static void syncFile(const string &flName){
+	const int fd = open(flName.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cerr << "ERROR: unable to open " << flName << " to save it to disk (" << strerror(errno) << ")" << endl;
+		exit(6);
 	}
-	
-	ifstream lstIn(fileList.c_str());
-	
-	if (!lstIn) {
-		cerr << "ERROR: cannot open file " << fileList << " listing files to process in SFsparse constructor" << endl;
-		exit(1);
+	if (fsync(fd) != 0) {
+		cerr << "ERROR: unable to save " << flName << " to disk (" << strerror(errno) << ")" << endl;
+		close(fd);
+		exit(6);
 	}
-	string eachFile;
-	while (getline(lstIn, eachFile)) {
-		if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
-			eachFile.erase(0, 2);
-			_refFlName = eachFile;
-		} else {
-			_inFileNames.push_back(eachFile);
-		}
-		
+	close(fd);
+}
+
+/** \brief Save a checkpoint
+ *
+ * The checkpoint is first saved to a temporary file and synchronized to disk, and then replaces the old checkpoint, so an interruption (including a node failure) never leaves a partial checkpoint.
+ *
+ * \param[in] ckptName checkpoint file name
+ * \param[in] ckpt checkpoint
+ */
+static void saveCheckpoint(const string &ckptName, const Checkpoint &ckpt){
+	const string tmpName   = ckptName + ".tmp";
+	const uint32_t version = 1;
+	ofstream ckptOut(tmpName.c_str(), ios::binary | ios::trunc);
+	if (!ckptOut) {
+		cerr << "ERROR: unable to open checkpoint file " << tmpName << " for output" << endl;
+		exit(6);
 	}
-	lstIn.close();
-	if (_inFileNames.size() > numeric_limits<unsigned short>::max()) {
-		cerr << "WARNING: number of lines " << _inFileNames.size() << " larger than allowed (" << numeric_limits<unsigned short>::max() << ")" << endl;
+	ckptOut.write("A2BC", 4);
+	ckptOut.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	ckptOut.write(reinterpret_cast<const char*>(&ckpt), sizeof(Checkpoint));
+	ckptOut.close();
+	if (!ckptOut) {
+		cerr << "ERROR: unable to write checkpoint file " << tmpName << endl;
+		exit(6);
+	}
+	syncFile(tmpName);
+	if (rename(tmpName.c_str(), ckptName.c_str()) != 0) {
+		cerr << "ERROR: unable to save checkpoint file " << ckptName << endl;
+		exit(6);
+	}
+	const size_t slashPos = ckptName.rfind('/');
+	syncFile( slashPos == string::npos ? string(".") : ckptName.substr(0, slashPos + 1) );
+}
+
+/** \brief File size
+ *
+ * \param[in] flName file name
+ *
+ * \return file size in bytes, or 0 if the file does not exist
+ */
+static uint64_t fileSize(const string &flName){
+	struct stat flStat;
+	if (stat(flName.c_str(), &flStat) != 0) {
+		return 0;
 	}
 	
-	for (auto flIt = _inFileNames.begin(); flIt != _inFileNames.end(); ++flIt) {
-		string locNam;
-		for (size_t pos = 0; pos < flIt->size(); pos++) {
-			if ( ((*flIt)[pos] == '/') || ((*flIt)[pos] == '\\') ) { // strip out *nix or Windows directory markers
-				locNam.clear();
-				continue;
-			}
-			if ( ((*flIt)[pos] == '_') || ((*flIt)[pos] == '.') ) {
-				break;
-			}
-			locNam += (*flIt)[pos];
+	return flStat.st_size;
+}
+
+/** \brief Checkpointing BED visitor
+ *
+ * Passes SNPs on to a BEDwriter and saves a checkpoint after each chunk, once the output streams are flushed and synchronized to disk.
+ */
+class BEDcheckpoint : public SNPvisitor {
+private:
+	/// BED writer
+	BEDwriter &_writer;
+	/// BED output stream
+	ofstream &_bedOut;
+	/// _.bim_ output stream
+	ofstream &_bimOut;
+	/// BED file name
+	string _bedName;
+	/// _.bim_ file name
+	string _bimName;
+	/// Checkpoint file name
+	string _ckptName;
+	/// Current checkpoint
+	Checkpoint _state;
+	/// SNPs saved before the run was resumed
+	uint64_t _nSNPprior;
+	
+public:
+	/** \brief Constructor
+	 *
+	 * \param[in] writer BED writer
+	 * \param[in] bedOut BED output stream
+	 * \param[in] bimOut _.bim_ output stream
+	 * \param[in] bedName BED file name
+	 * \param[in] bimName _.bim_ file name
+	 * \param[in] ckptName checkpoint file name
+	 * \param[in] start starting state
+	 */
+	BEDcheckpoint(BEDwriter &writer, ofstream &bedOut, ofstream &bimOut, const string &bedName, const string &bimName, const string &ckptName, const Checkpoint &start) : _writer(writer), _bedOut(bedOut), _bimOut(bimOut), _bedName(bedName), _bimName(bimName), _ckptName(ckptName), _state(start), _nSNPprior(start.nSNP) {};
+	
+	/** \brief Save a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec) {_writer.snp(rec); };
+	/** \brief Save a checkpoint
+	 *
+	 * The output reaches the disk before the checkpoint that records it, so a checkpoint never points past saved data.
+	 *
+	 * \param[in] nextOffset zero-based offset of the first site of the next chunk
+	 */
+	void chunkDone(const size_t &nextOffset) {
+		_bedOut.flush();
+		_bimOut.flush();
+		if ( !_bedOut || !_bimOut ) {
+			cerr << "ERROR: unable to write " << _bedName << " or " << _bimName << " before a checkpoint" << endl;
+			exit(6);
 		}
-		_lineNames.push_back(locNam);
-	}
+		syncFile(_bedName);
+		syncFile(_bimName);
+		_state.nextOffset = nextOffset;
+		_state.nSNP       = nSNP();
+		_state.bedLength  = _bedOut.tellp();
+		_state.bimLength  = _bimOut.tellp();
+		saveCheckpoint(_ckptName, _state);
+	};
+	/** \brief Number of SNPs
+	 *
+	 * \return number of SNPs saved, including those before the run was resumed
+	 */
+	uint64_t nSNP() const {return _nSNPprior + _writer.nSNP(); };
+};
+
+/** \brief Pair of SNP visitors
+ *
+ * Passes everything on to two visitors, in order.
+ */
+class VisitorPair : public SNPvisitor {
+private:
+	/// First visitor
+	SNPvisitor &_first;
+	/// Second visitor
+	SNPvisitor &_second;
 	
+public:
+	/** \brief Constructor
+	 *
+	 * \param[in] first first visitor
+	 * \param[in] second second visitor
+	 */
+	VisitorPair(SNPvisitor &first, SNPvisitor &second) : _first(first), _second(second) {};
+	
+	/** \brief Process a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec) {_first.snp(rec); _second.snp(rec); };
+	/** \brief Chunk finished
+	 *
+	 * \param[in] nextOffset zero-based offset of the first site of the next chunk
+	 */
+	void chunkDone(const size_t &nextOffset) {_first.chunkDone(nextOffset); _second.chunkDone(nextOffset); };
+	/** \brief Chunk sequences
+	 *
+	 * \param[in] refBuf reference (ancestral) sequence
+	 * \param[in] seqBufs sequences of the lines
+	 * \param[in] nLines number of lines
+	 * \param[in] nSites number of sites in the chunk
+	 * \param[in] offset zero-based position of the first site
+	 */
+	void sites(const char *refBuf, const char * const *seqBufs, const size_t &nLines, const size_t &nSites, const size_t &offset) {
+		_first.sites(refBuf, seqBufs, nLines, nSites, offset);
+		_second.sites(refBuf, seqBufs, nLines, nSites, offset);
+	};
+};
+
+/** \brief Site summary
+ *
+ * Per-site state of a BED conversion, saved for incremental updates. For each site it stores the first non-missing allele in the sample (_N_ if all lines are missing) and the second allele (_\\0_ if the site is monomorphic, _*_ if it has more than two alleles).
+ * Missing genotypes of each line are stored as runs of _N_. The input files are recorded with their sizes and modification times to make sure they have not changed.
+ */
+struct SiteSummary {
+	/// Chromosome name
+	string chromName;
+	/// Input file names, reference first
+	vector<string> files;
+	/// Input file sizes
+	vector<uint64_t> sizes;
+	/// Input file modification times
+	vector<int64_t> mtimes;
+	/// First non-missing allele at each site
+	vector<char> first;
+	/// Second allele at each site
+	vector<char> alt;
+	/// Runs of missing genotypes for each line, as zero-based start and one-past-the-end pairs
+	vector< vector<uint32_t> > nRuns;
+};
+
+/** \brief File size and modification time
+ *
+ * \param[in] flName file name
+ * \param[out] size file size
+ * \param[out] mtime modification time
+ */
+static void fileStamp(const string &flName, uint64_t &size, int64_t &mtime){
+	struct stat flStat;
+	if (stat(flName.c_str(), &flStat) != 0) {
+		cerr << "ERROR: unable to open file " << flName << " in SFparse()" << endl;
+		exit(5);
+	}
+	size  = flStat.st_size;
+	mtime = flStat.st_mtime;
 }
 
-SFparse::SFparse(const string &fileList, const string &outFlNam, const unsigned long &alloc) : _outFileName(outFlNam), _bufAlloc(alloc) {
-	string ext;
-	bool foundDot = false;
-	for (size_t pos = _outFileName.size() - 1; pos > 0; pos--) {
-		if (foundDot) {
-			if (_outFileName[pos] == '_') {
-				break;
-			}
-			_chromName = _outFileName[pos] + _chromName;
-			
+/** \brief Add runs of missing genotypes
+ *
+ * Appends the runs of _N_ in a chunk of sequence to the list of runs, joining a run that continues from the previous chunk.
+ *
+ * \param[in] seq sequence chunk
+ * \param[in] len chunk length
+ * \param[in] offset zero-based position of the chunk start
+ * \param[in,out] runs runs of missing genotypes
+ */
+static void addNruns(const char *seq, const size_t &len, const size_t &offset, vector<uint32_t> &runs){
+	size_t pos = 0;
+	while (pos < len) {
+		const char *nPtr = static_cast<const char*>( memchr(seq + pos, 'N', len - pos) );
+		if (nPtr == nullptr) {
+			break;
 		}
-		if (_outFileName[pos] == '.') {
-			foundDot = true;
+		const size_t runBeg = nPtr - seq;
+		size_t runEnd       = runBeg + 1;
+		while ( (runEnd < len) && (seq[runEnd] == 'N') ) {
+			runEnd++;
 		}
-		if (!foundDot) {
-			ext = _outFileName[pos] + ext;
+		if ( !runs.empty() && (runs.back() == offset + runBeg) ) {
+			runs.back() = offset + runEnd;
+		} else {
+			runs.push_back(offset + runBeg);
+			runs.push_back(offset + runEnd);
 		}
+		pos = runEnd;
 	}
-	if (!foundDot) {
-		cerr << "ERROR: no extension found in file " << _outFileName << " in SFparse extension-based constructor" << endl;
-		exit(2);
+}
+
+/** \brief Save a site summary
+ *
+ * \param[in] sumName summary file name
+ * \param[in] summary site summary
+ */
+static void saveSummary(const string &sumName, const SiteSummary &summary){
+	const string tmpName   = sumName + ".tmp";
+	const uint32_t version = 1;
+	const uint32_t nFiles  = summary.files.size();
+	const uint64_t nSites  = summary.first.size();
+	ofstream sumOut(tmpName.c_str(), ios::binary | ios::trunc);
+	if (!sumOut) {
+		cerr << "ERROR: unable to open site summary file " << tmpName << " for output" << endl;
+		exit(6);
 	}
-	if (_chromName.empty()) {
-		cerr << "WARNING: no chromosome name found in output file name " << _outFileName << " in SFsparse constructor; setting default" << endl;
-		_chromName = "NN";
-		_chromNum  = 0;
-	} else {
-		_chromNum = 1;
+	sumOut.write("A2BS", 4);
+	sumOut.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	const uint32_t chrLen = summary.chromName.size();
+	sumOut.write(reinterpret_cast<const char*>(&chrLen), sizeof(uint32_t));
+	sumOut.write(summary.chromName.c_str(), chrLen);
+	sumOut.write(reinterpret_cast<const char*>(&nFiles), sizeof(uint32_t));
+	for (uint32_t iFl = 0; iFl < nFiles; iFl++) {
+		const uint32_t nameLen = summary.files[iFl].size();
+		sumOut.write(reinterpret_cast<const char*>(&nameLen), sizeof(uint32_t));
+		sumOut.write(summary.files[iFl].c_str(), nameLen);
+		sumOut.write(reinterpret_cast<const char*>(&summary.sizes[iFl]), sizeof(uint64_t));
+		sumOut.write(reinterpret_cast<const char*>(&summary.mtimes[iFl]), sizeof(int64_t));
 	}
-	if (ext == "bvt") {
-		_outFileType = "BVT";
-	} else if (ext == "bed") {
-		_outFileType = "BED";
-	} else {
-		cerr << "ERROR: unknown extension " << ext << " for output file in SFparse extension-based constructor" << endl;
-		exit(3);
+	sumOut.write(reinterpret_cast<const char*>(&nSites), sizeof(uint64_t));
+	sumOut.write(summary.first.data(), nSites);
+	sumOut.write(summary.alt.data(), nSites);
+	for (auto runIt = summary.nRuns.begin(); runIt != summary.nRuns.end(); ++runIt) {
+		const uint64_t nVal = runIt->size();
+		sumOut.write(reinterpret_cast<const char*>(&nVal), sizeof(uint64_t));
+		sumOut.write(reinterpret_cast<const char*>(runIt->data()), nVal*sizeof(uint32_t));
 	}
-	ext.clear();
-	auto outIt = _outFileName.end();
-	_outFileName.erase(outIt - 4, outIt); // erase the extension
-	
-	ifstream lstIn(fileList.c_str());
-	
-	if (!lstIn) {
-		cerr << "ERROR: cannot open file " << fileList << " listing files to process in SFsparse extension-based constructor" << endl;
-		exit(1);
+	sumOut.close();
+	if (rename(tmpName.c_str(), sumName.c_str()) != 0) {
+		cerr << "ERROR: unable to save site summary file " << sumName << endl;
+		exit(6);
 	}
-	string eachFile;
-	getline(lstIn, eachFile);
-	foundDot = false;
-	for (size_t pos = eachFile.size() - 1; pos > 0; pos--) {
-		if (eachFile[pos] == '.') {
-			foundDot = true;
-			break;
+}
+
+/** \brief Load a site summary
+ *
+ * \param[in] sumName summary file name
+ * \param[out] summary site summary
+ *
+ * \return _true_ if a valid summary was read
+ */
+static bool loadSummary(const string &sumName, SiteSummary &summary){
+	ifstream sumIn(sumName.c_str(), ios::binary);
+	if (!sumIn) {
+		return false;
+	}
+	char tag[4];
+	uint32_t version = 0;
+	uint32_t chrLen  = 0;
+	uint32_t nFiles  = 0;
+	uint64_t nSites  = 0;
+	sumIn.read(tag, 4);
+	sumIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	sumIn.read(reinterpret_cast<char*>(&chrLen), sizeof(uint32_t));
+	if ( !sumIn || (string(tag, 4) != "A2BS") || (version != 1) || (chrLen > 1024) ) {
+		return false;
+	}
+	summary.chromName.resize(chrLen);
+	sumIn.read(&summary.chromName[0], chrLen);
+	sumIn.read(reinterpret_cast<char*>(&nFiles), sizeof(uint32_t));
+	summary.files.resize(nFiles);
+	summary.sizes.resize(nFiles);
+	summary.mtimes.resize(nFiles);
+	for (uint32_t iFl = 0; sumIn && (iFl < nFiles); iFl++) {
+		uint32_t nameLen = 0;
+		sumIn.read(reinterpret_cast<char*>(&nameLen), sizeof(uint32_t));
+		if (nameLen > 65536) {
+			return false;
 		}
-		ext = eachFile[pos] + ext;
+		summary.files[iFl].resize(nameLen);
+		sumIn.read(&summary.files[iFl][0], nameLen);
+		sumIn.read(reinterpret_cast<char*>(&summary.sizes[iFl]), sizeof(uint64_t));
+		sumIn.read(reinterpret_cast<char*>(&summary.mtimes[iFl]), sizeof(int64_t));
 	}
-	if (ext == "seq") {
-		_inFileType = "SEQ";
-	} else {
-		cerr << "ERROR: unknown extension " << ext << " for input files in SFparse extension-based constructor" << endl;
-		exit(3);
+	sumIn.read(reinterpret_cast<char*>(&nSites), sizeof(uint64_t));
+	if ( !sumIn || (nFiles == 0) ) {
+		return false;
 	}
-	
-	if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
-		eachFile.erase(0, 2);
-		_refFlName = eachFile;
-	} else {
-		_inFileNames.push_back(eachFile);
+	summary.first.resize(nSites);
+	summary.alt.resize(nSites);
+	sumIn.read(summary.first.data(), nSites);
+	sumIn.read(summary.alt.data(), nSites);
+	summary.nRuns.resize(nFiles - 1);
+	for (auto runIt = summary.nRuns.begin(); sumIn && (runIt != summary.nRuns.end()); ++runIt) {
+		uint64_t nVal = 0;
+		sumIn.read(reinterpret_cast<char*>(&nVal), sizeof(uint64_t));
+		if ( nVal > 2*nSites ) {
+			return false;
+		}
+		runIt->resize(nVal);
+		sumIn.read(reinterpret_cast<char*>(runIt->data()), nVal*sizeof(uint32_t));
 	}
-	while (getline(lstIn, eachFile)) {
-		if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
-			eachFile.erase(0, 2);
-			_refFlName = eachFile;
-		} else {
-			_inFileNames.push_back(eachFile);
+	
+	return static_cast<bool>(sumIn);
+}
+
+/// Compressed bytes read at a time from a gzip or BGZF file
+static const size_t packedBatch = 4194304;
+#ifdef USE_ZLIB
+/// Inflation helper threads running in all readers; bounded by the number of cores
+static atomic<unsigned int> nInflateHelpers(0);
+
+/** \brief Borrow inflation helpers
+ *
+ * Takes helpers from the pool shared by all readers while cores are free. Give them back by subtracting from _nInflateHelpers_ once they are joined.
+ *
+ * \param[in] nWanted number of helpers wanted
+ *
+ * \return number of helpers granted; may be 0
+ */
+static unsigned int borrowHelpers(const unsigned int &nWanted){
+	const unsigned int nCores     = thread::hardware_concurrency();
+	const unsigned int maxHelpers = (nCores ? nCores : 1);
+	unsigned int nRunning         = nInflateHelpers.load();
+	while ( nWanted && (nRunning < maxHelpers) ) {
+		const unsigned int nTake = (maxHelpers - nRunning < nWanted ? maxHelpers - nRunning : nWanted);
+		if ( nInflateHelpers.compare_exchange_weak(nRunning, nRunning + nTake) ) {
+			return nTake;
 		}
 	}
 	
-	lstIn.close();
+	return 0;
+}
+#endif
+
+/** \brief Sequence file reader
+ *
+ * Reads a plain, gzip or BGZF sequence file at uncompressed offsets; the compression is recognized from the first bytes of the file.
+ * The file is opened anew for each read, so that many lines can be read without running out of file handles.
+ * BGZF blocks are located with the _.gzi_ index, if there is an up to date one, or by walking the block headers. Blocks are inflated straight into the caller's buffer, with a few helper threads from a pool shared by all readers when cores are free. Only a block split by the end of a read is kept for the next one.
+ * A gzip file can only be inflated from the beginning, so the reader keeps the inflation state and the compressed offset between reads. Reads are expected to move forward through the file; going back starts over. Readers of different gzip files can be read by different threads at the same time (see readEach()).
+ * Problems with the file (it cannot be opened, is truncated or corrupt) do not stop the program. The first one is recorded, further reads return nothing, and the caller decides what to do (see problem() and stopOnProblem()).
+ */
+class SeqReader {
+private:
+	/// File name
+	string _flName;
+	/// Compression: 0 for none, 1 for gzip, 2 for BGZF
+	int _format;
+	/// Compressed offsets of the BGZF blocks, with the end of the last block at the back
+	vector<uint64_t> _blockOffsets;
+	/// Uncompressed offsets of the BGZF blocks, with the total uncompressed length at the back
+	vector<uint64_t> _blockStarts;
+	/// BGZF block split by the end of the latest read
+	vector<char> _splitBlock;
+	/// Uncompressed offset of the split block
+	uint64_t _splitStart;
+#ifdef USE_ZLIB
+	/// gzip inflation state
+	z_stream _strm;
+#endif
+	/// Compressed offset of the next gzip byte to inflate
+	uint64_t _packedPos;
+	/// Uncompressed offset of the next inflated gzip byte
+	uint64_t _streamPos;
+	/// The current gzip member is finished
+	bool _memberDone;
+	/// First problem found with the file; empty if none
+	string _problem;
+	/// Exit code for the problem: 4 if the build cannot read the file, 5 if the file is bad
+	int _problemCode;
 	
-	for (auto flIt = _inFileNames.begin(); flIt != _inFileNames.end(); ++flIt) {
-		string locNam;
-		for (size_t pos = 0; pos < flIt->size(); pos++) {
-			if ( ((*flIt)[pos] == '/') || ((*flIt)[pos] == '\\') ) { // strip out *nix or Windows directory markers
-				locNam.clear();
-				continue;
-			}
-			if ( ((*flIt)[pos] == '_') || ((*flIt)[pos] == '.') ) {
-				break;
-			}
-			locNam += (*flIt)[pos];
+	/** \brief Record a problem
+	 *
+	 * Only the first problem is kept.
+	 *
+	 * \param[in] problem problem description
+	 * \param[in] code exit code for stopOnProblem()
+	 */
+	void _fail(const string &problem, const int &code = 5);
+	/** \brief Open the file
+	 *
+	 * \return file descriptor; -1 if the file cannot be opened
+	 */
+	int _open();
+	/** \brief Read from the file
+	 *
+	 * Repeats _pread()_ until the buffer is full or the end of the file is reached.
+	 *
+	 * \param[in] fd file descriptor
+	 * \param[out] buf buffer
+	 * \param[in] nBytes number of bytes to read
+	 * \param[in] offset file offset
+	 *
+	 * \return number of bytes read; short of _nBytes_ at the end of the file or if there is a read error
+	 */
+	size_t _preadAll(const int &fd, char *buf, size_t nBytes, uint64_t offset);
+#ifdef USE_ZLIB
+	/** \brief Locate the BGZF blocks */
+	void _loadBlocks();
+	/** \brief Decompress a BGZF block
+	 *
+	 * \param[in] block compressed block
+	 * \param[in] blockLen compressed block length
+	 * \param[out] out decompressed data
+	 * \param[in] outLen expected decompressed length
+	 *
+	 * \return true if the block decompressed to exactly _outLen_ bytes
+	 */
+	static bool _inflateBlock(const unsigned char *block, const size_t &blockLen, char *out, const size_t &outLen);
+	/** \brief Read from a BGZF file
+	 *
+	 * \param[in] offset zero-based uncompressed offset
+	 * \param[out] buf buffer
+	 * \param[in] len number of bytes to read
+	 *
+	 * \return number of bytes read
+	 */
+	size_t _readBGZF(const uint64_t &offset, char *buf, const size_t &len);
+	/** \brief Read from a gzip file
+	 *
+	 * \param[in] offset zero-based uncompressed offset
+	 * \param[out] buf buffer
+	 * \param[in] len number of bytes to read
+	 *
+	 * \return number of bytes read
+	 */
+	size_t _readGzip(const uint64_t &offset, char *buf, const size_t &len);
+#endif
+
+public:
+	/** \brief Constructor
+	 *
+	 * \param[in] flName file name
+	 */
+	SeqReader(const string &flName);
+	/** \brief Destructor */
+	~SeqReader();
+	/** \brief Copy constructor (deleted) */
+	SeqReader(const SeqReader &inObj) = delete;
+	/** \brief Copy assignment (deleted) */
+	SeqReader& operator=(const SeqReader &inObj) = delete;
+	
+	/** \brief Is the file compressed?
+	 *
+	 * \return true for gzip or BGZF files
+	 */
+	bool compressed() const {return _format != 0; };
+	/** \brief Is the file plain gzip?
+	 *
+	 * \return true for gzip files that are not BGZF, which can only be inflated by one thread
+	 */
+	bool gzip() const {return _format == 1; };
+	/** \brief Problem with the file
+	 *
+	 * \return description of the first problem found; empty if there is none
+	 */
+	const string& problem() const {return _problem; };
+	/** \brief Stop on a problem
+	 *
+	 * Prints the problem and exits, if there is one. Meant for conversions, where a bad file cannot be worked around.
+	 */
+	void stopOnProblem() const;
+	/** \brief Read uncompressed bytes
+	 *
+	 * \param[in] offset zero-based uncompressed offset
+	 * \param[out] buf buffer
+	 * \param[in] len number of bytes to read
+	 *
+	 * \return number of bytes read; less than _len_ only at the end of the file or if there is a problem
+	 */
+	size_t read(const uint64_t &offset, char *buf, const size_t &len);
+	/** \brief Read a chunk of the sequence
+	 *
+	 * Works like _istream::get()_: reads up to _bufSize - 1_ nucleotides, stopping before an end of line, and null-terminates the buffer.
+	 *
+	 * \param[in] offset zero-based uncompressed offset
+	 * \param[out] buf buffer
+	 * \param[in] bufSize buffer size
+	 *
+	 * \return number of nucleotides read
+	 */
+	size_t getLine(const uint64_t &offset, char *buf, const size_t &bufSize);
+};
+
+SeqReader::SeqReader(const string &flName) : _flName(flName), _format(0), _splitStart(numeric_limits<uint64_t>::max()), _packedPos(0), _streamPos(0), _memberDone(false), _problemCode(0) {
+	const int fd = _open();
+	if (fd == -1) {
+		return;
+	}
+	unsigned char header[18];
+	const size_t nRead = _preadAll(fd, reinterpret_cast<char*>(header), 18, 0);
+	close(fd);
+	if ( (nRead >= 2) && (header[0] == 0x1f) && (header[1] == 0x8b) ) {
+		const bool bgzf = (nRead == 18) && (header[3] & 0x04) && (header[10] == 0x06) && (header[11] == 0) && (header[12] == 'B') && (header[13] == 'C');
+		_format         = (bgzf ? 2 : 1);
+	}
+#ifdef USE_ZLIB
+	if (_format == 2) {
+		_loadBlocks();
+	} else if (_format == 1) {
+		_strm.zalloc   = Z_NULL;
+		_strm.zfree    = Z_NULL;
+		_strm.opaque   = Z_NULL;
+		_strm.next_in  = Z_NULL;
+		_strm.avail_in = 0;
+		if (inflateInit2(&_strm, 15 + 16) != Z_OK) { // gzip wrapper
+			_format = 0; // nothing for the destructor to free
+			_fail("unable to initialize gzip decompression");
 		}
-		_lineNames.push_back(locNam);
+	}
+#else
+	if (_format) {
+		_fail("compressed input requires compiling with USE_ZLIB", 4);
+	}
+#endif
+}
+
+SeqReader::~SeqReader(){
+#ifdef USE_ZLIB
+	if (_format == 1) {
+		inflateEnd(&_strm);
+	}
+#endif
+}
+
+void SeqReader::_fail(const string &problem, const int &code){
+	if ( _problem.empty() ) {
+		_problem     = problem;
+		_problemCode = code;
+	}
+}
+
+void SeqReader::stopOnProblem() const {
+	if ( !_problem.empty() ) {
+		cerr << "ERROR: input file " << _flName << ": " << _problem << " in SeqReader()" << endl;
+		exit(_problemCode);
+	}
+}
+
+int SeqReader::_open(){
+	const int fd = open(_flName.c_str(), O_RDONLY);
+	if (fd == -1) {
+		_fail( "cannot be opened (" + string( strerror(errno) ) + ")" );
 	}
 	
-	if (_inFileNames.size() > numeric_limits<unsigned int>::max()) {
-		cerr << "WARNING: number of lines " << _inFileNames.size() << " larger than allowed (" << numeric_limits<unsigned int>::max() << ")" << endl;
+	return fd;
+}
+
+size_t SeqReader::_preadAll(const int &fd, char *buf, size_t nBytes, uint64_t offset){
+	size_t nRead = 0;
+	while (nBytes) {
+		const ssize_t nNow = pread(fd, buf + nRead, nBytes, offset);
+		if (nNow < 0) {
+			_fail( "cannot be read (" + string( strerror(errno) ) + ")" );
+			break;
+		}
+		if (nNow == 0) { // end of the file
+			break;
+		}
+		nRead  += nNow;
+		nBytes -= nNow;
+		offset += nNow;
 	}
+	
+	return nRead;
 }
-SFparse& SFparse::operator=(const SFparse &inObj){
-	if (this != &inObj) {
-		_inFileNames = inObj._inFileNames;
-		_lineNames   = inObj._lineNames;
-		_refFlName   = inObj._refFlName;
-		_outFileName = inObj._outFileName;
-		_inFileType  = inObj._inFileType;
-		_outFileType = inObj._outFileType;
-		_chromName   = inObj._chromName;
-		_chromNum    = inObj._chromNum;
-		_bufAlloc    = inObj._bufAlloc;
-		
+
+size_t SeqReader::getLine(const uint64_t &offset, char *buf, const size_t &bufSize){
+	size_t nRead = read(offset, buf, bufSize - 1);
+	const char *lineEnd = static_cast<const char*>( memchr(buf, '\n', nRead) );
+	if (lineEnd != nullptr) {
+		nRead = lineEnd - buf;
 	}
+	buf[nRead] = '\0';
 	
-	return *this;
+	return nRead;
 }
 
-SFparse& SFparse::operator=(SFparse &&inObj){
-	if (this != &inObj) {
-		_inFileNames = move(inObj._inFileNames);
-		_lineNames   = move(inObj._lineNames);
-		_refFlName   = move(inObj._refFlName);
-		_outFileName = move(inObj._outFileName);
-		_inFileType  = move(inObj._inFileType);
-		_outFileType = move(inObj._outFileType);
-		_chromName   = move(inObj._chromName);
-		_chromNum    = move(inObj._chromNum);
-		_bufAlloc    = move(inObj._bufAlloc);
-		
+size_t SeqReader::read(const uint64_t &offset, char *buf, const size_t &len){
+	if ( !_problem.empty() ) {
+		return 0;
 	}
+#ifdef USE_ZLIB
+	if (_format == 2) {
+		return _readBGZF(offset, buf, len);
+	}
+	if (_format == 1) {
+		return _readGzip(offset, buf, len);
+	}
+#endif
+	const int fd = _open();
+	if (fd == -1) {
+		return 0;
+	}
+	const size_t nRead = _preadAll(fd, buf, len, offset);
+	close(fd);
 	
-	return *this;
+	return nRead;
 }
 
-void SFparse::operator()(){
-	if ( (_inFileType == "SEQ") && (_outFileType == "BVT") ) {
-		size_t bufSize = _bufAlloc/(_inFileNames.size() + 1);
-		bool notDone = true;
-		
-		string fullOutName   = _outFileName + ".bvt";
-		string outMetaFlName = _outFileName + ".bvtm";
-		ofstream outMeta(outMetaFlName);
-		if (!outMeta) {
-			cerr << "ERROR: unable to open file " << outMetaFlName << " for metadata output in SFparse()" << endl;
-			exit(6);
+#ifdef USE_ZLIB
+void SeqReader::_loadBlocks(){
+	_blockOffsets.assign(1, 0);
+	_blockStarts.assign(1, 0);
+	// the .gzi index (as saved by bgzip -i) lists the compressed and uncompressed offsets of all blocks but the first
+	const string gziName = _flName + ".gzi";
+	struct stat seqStat;
+	struct stat gziStat;
+	if ( (stat(_flName.c_str(), &seqStat) == 0) && (stat(gziName.c_str(), &gziStat) == 0) && (gziStat.st_mtime >= seqStat.st_mtime) ) {
+		ifstream gziIn(gziName.c_str(), ios::binary);
+		uint64_t nEntries = 0;
+		gziIn.read(reinterpret_cast<char*>(&nEntries), sizeof(uint64_t));
+		if ( gziIn && (static_cast<uint64_t>(gziStat.st_size) == sizeof(uint64_t)*(1 + 2*nEntries)) ) {
+			for (uint64_t iEnt = 0; iEnt < nEntries; iEnt++) {
+				uint64_t offsets[2];
+				gziIn.read(reinterpret_cast<char*>(offsets), 2*sizeof(uint64_t));
+				if ( !gziIn || (offsets[0] <= _blockOffsets.back()) || (offsets[1] < _blockStarts.back()) ) { // not a usable index; walk all the blocks instead
+					_blockOffsets.assign(1, 0);
+					_blockStarts.assign(1, 0);
+					break;
+				}
+				_blockOffsets.push_back(offsets[0]);
+				_blockStarts.push_back(offsets[1]);
+			}
 		}
-		outMeta << _chromName << flush;
-		for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
-			outMeta << " " << *lnNamIt << flush;
+	}
+	// walk from the last indexed block to the end of the file; empty blocks (e.g., the end-of-file marker) are left out
+	uint64_t packedPos = _blockOffsets.back();
+	uint64_t seqPos    = _blockStarts.back();
+	_blockOffsets.pop_back();
+	_blockStarts.pop_back();
+	const int fd = _open();
+	while (fd != -1) {
+		unsigned char header[18];
+		const size_t nHead = _preadAll(fd, reinterpret_cast<char*>(header), 18, packedPos);
+		if ( (nHead == 0) || !_problem.empty() ) {
+			break;
+		}
+		if ( (nHead < 18) || (header[0] != 0x1f) || (header[1] != 0x8b) || !(header[3] & 0x04) || (header[12] != 'B') || (header[13] != 'C') ) {
+			_fail( "not valid BGZF at byte " + to_string(packedPos) );
+			break;
+		}
+		const uint64_t blockLen = (static_cast<uint64_t>(header[16]) | (static_cast<uint64_t>(header[17]) << 8)) + 1;
+		unsigned char footer[4];
+		if (_preadAll(fd, reinterpret_cast<char*>(footer), 4, packedPos + blockLen - 4) < 4) {
+			_fail("truncated BGZF data");
+			break;
+		}
+		const uint64_t inflatedLen = static_cast<uint64_t>(footer[0]) | (static_cast<uint64_t>(footer[1]) << 8) | (static_cast<uint64_t>(footer[2]) << 16) | (static_cast<uint64_t>(footer[3]) << 24);
+		if (inflatedLen) {
+			_blockOffsets.push_back(packedPos);
+			_blockStarts.push_back(seqPos);
+		}
+		packedPos += blockLen;
+		seqPos    += inflatedLen;
+	}
+	if (fd != -1) {
+		close(fd);
+	}
+	_blockOffsets.push_back(packedPos);
+	_blockStarts.push_back(seqPos);
+}
+
+bool SeqReader::_inflateBlock(const unsigned char *block, const size_t &blockLen, char *out, const size_t &outLen){
+	z_stream strm;
+	strm.zalloc   = Z_NULL;
+	strm.zfree    = Z_NULL;
+	strm.opaque   = Z_NULL;
+	strm.next_in  = Z_NULL;
+	strm.avail_in = 0;
+	if (inflateInit2(&strm, 15 + 16) != Z_OK) { // gzip wrapper
+		return false;
+	}
+	strm.next_in   = const_cast<Bytef*>(block);
+	strm.avail_in  = blockLen;
+	strm.next_out  = reinterpret_cast<Bytef*>(out);
+	strm.avail_out = outLen;
+	const int status = inflate(&strm, Z_FINISH);
+	const bool good  = (status == Z_STREAM_END) && (strm.total_out == outLen);
+	inflateEnd(&strm);
+	
+	return good;
+}
+
+size_t SeqReader::_readBGZF(const uint64_t &offset, char *buf, const size_t &len){
+	const uint64_t total = _blockStarts.back();
+	if (offset >= total) {
+		return 0;
+	}
+	const uint64_t end = (total - offset < len ? total : offset + len);
+	// blocks firstBlock to lastBlock - 1 cover the read; only the first and the last can be split by it
+	const size_t firstBlock = upper_bound(_blockStarts.begin(), _blockStarts.end(), offset) - _blockStarts.begin() - 1;
+	const size_t lastBlock  = lower_bound(_blockStarts.begin(), _blockStarts.end(), end) - _blockStarts.begin();
+	vector<char> headBlock;
+	vector<char> tailBlock;
+	vector<unsigned char> packed;
+	atomic<bool> failed(false);
+	// inflates a block into the buffer, or into a scratch block if the read splits it
+	auto doBlock = [this, offset, end, buf, firstBlock, &headBlock, &tailBlock, &packed](const size_t &iBlock, const uint64_t &packedStart) -> bool {
+		const uint64_t blockBeg = _blockStarts[iBlock];
+		const uint64_t blockEnd = _blockStarts[iBlock + 1];
+		const uint64_t copyBeg  = (blockBeg > offset ? blockBeg : offset);
+		const uint64_t copyEnd  = (blockEnd < end ? blockEnd : end);
+		const unsigned char *block = packed.data() + (_blockOffsets[iBlock] - packedStart);
+		const size_t blockLen      = _blockOffsets[iBlock + 1] - _blockOffsets[iBlock];
+		if (blockBeg == _splitStart) { // split by the previous read
+			memcpy(buf + (copyBeg - offset), _splitBlock.data() + (copyBeg - blockBeg), copyEnd - copyBeg);
+			return true;
+		}
+		if ( (blockBeg >= offset) && (blockEnd <= end) ) {
+			return _inflateBlock(block, blockLen, buf + (blockBeg - offset), blockEnd - blockBeg);
+		}
+		vector<char> &scratch = (iBlock == firstBlock ? headBlock : tailBlock);
+		scratch.resize(blockEnd - blockBeg);
+		if ( !_inflateBlock(block, blockLen, scratch.data(), scratch.size()) ) {
+			return false;
+		}
+		memcpy(buf + (copyBeg - offset), scratch.data() + (copyBeg - blockBeg), copyEnd - copyBeg);
+		return true;
+	};
+	
+	const int fd = _open();
+	if (fd == -1) {
+		return 0;
+	}
+	size_t batchBeg = firstBlock;
+	while (batchBeg < lastBlock) {
+		// a batch is as many blocks as fit in packedBatch compressed bytes, and at least one
+		size_t batchEnd = batchBeg + 1;
+		while ( (batchEnd < lastBlock) && (_blockOffsets[batchEnd + 1] - _blockOffsets[batchBeg] <= packedBatch) ) {
+			batchEnd++;
+		}
+		const uint64_t packedStart = _blockOffsets[batchBeg];
+		packed.resize(_blockOffsets[batchEnd] - packedStart);
+		if (_preadAll(fd, reinterpret_cast<char*>(packed.data()), packed.size(), packedStart) < packed.size()) {
+			_fail("truncated BGZF data");
+			break;
+		}
+		// borrow helpers from the shared pool if cores are free; otherwise the calling thread inflates the batch alone
+		const unsigned int nHelpers = borrowHelpers( (batchEnd - batchBeg - 1)/8 );
+		atomic<size_t> nextBlock(batchBeg);
+		auto inflateBatch = [&doBlock, &nextBlock, &failed, batchEnd, packedStart](){
+			size_t iBlock;
+			while ( (iBlock = nextBlock++) < batchEnd ) {
+				if ( !doBlock(iBlock, packedStart) ) {
+					failed = true;
+				}
+			}
+		};
+		vector<thread> helpers;
+		for (unsigned int iHlp = 0; iHlp < nHelpers; iHlp++) {
+			helpers.push_back( thread(inflateBatch) );
+		}
+		inflateBatch(); // the calling thread does its share
+		for (auto thrIt = helpers.begin(); thrIt != helpers.end(); ++thrIt) {
+			thrIt->join();
+		}
+		nInflateHelpers -= nHelpers;
+		if (failed) {
+			_fail("corrupt BGZF block");
+			break;
+		}
+		batchBeg = batchEnd;
+	}
+	close(fd);
+	if ( !_problem.empty() ) {
+		return 0;
+	}
+	
+	// keep the last block if the read splits it, because the next read starts there
+	const size_t splitBlock = lastBlock - 1;
+	if ( (_blockStarts[lastBlock] > end) && (_blockStarts[splitBlock] != _splitStart) ) {
+		_splitBlock.swap(splitBlock == firstBlock ? headBlock : tailBlock);
+		_splitStart = _blockStarts[splitBlock];
+	}
+	
+	return end - offset;
+}
+
+size_t SeqReader::_readGzip(const uint64_t &offset, char *buf, const size_t &len){
+	if (offset < _streamPos) { // going back means starting over
+		inflateReset(&_strm);
+		_packedPos  = 0;
+		_streamPos  = 0;
+		_memberDone = false;
+	}
+	const int fd = _open();
+	if (fd == -1) {
+		return 0;
+	}
+	vector<char> packed(131072);
+	vector<char> skipped;
+	size_t nCopied = 0;
+	_strm.avail_in = 0;
+	while (nCopied < len) {
+		if (_strm.avail_in == 0) {
+			const size_t nRead = _preadAll(fd, packed.data(), packed.size(), _packedPos);
+			if (nRead == 0) {
+				if (!_memberDone) {
+					_fail("truncated gzip data");
+				}
+				break;
+			}
+			_strm.next_in  = reinterpret_cast<Bytef*>( packed.data() );
+			_strm.avail_in = nRead;
+			_packedPos    += nRead;
+		}
+		if (_memberDone) { // another gzip member follows (e.g., concatenated files)
+			inflateReset(&_strm);
+			_memberDone = false;
+		}
+		// inflate into the caller's buffer, or into a scratch buffer to skip ahead to the offset
+		char *out        = buf + nCopied;
+		size_t outLen    = len - nCopied;
+		const bool skip  = (_streamPos < offset);
+		if (skip) {
+			skipped.resize(65536);
+			out    = skipped.data();
+			outLen = (offset - _streamPos < skipped.size() ? offset - _streamPos : skipped.size());
+		}
+		outLen = (outLen < 1073741824 ? outLen : 1073741824); // avail_out is 32 bit
+		_strm.next_out  = reinterpret_cast<Bytef*>(out);
+		_strm.avail_out = outLen;
+		const int status      = inflate(&_strm, Z_NO_FLUSH);
+		const size_t inflated = outLen - _strm.avail_out;
+		_streamPos += inflated;
+		if (!skip) {
+			nCopied += inflated;
+		}
+		if (status == Z_STREAM_END) {
+			_memberDone = true;
+		} else if ( (status != Z_OK) && !( (status == Z_BUF_ERROR) && (_strm.avail_in == 0) ) ) {
+			_fail("corrupt gzip data");
+			break;
+		}
+	}
+	close(fd);
+	_packedPos    -= _strm.avail_in; // input read but not used yet is read again next time
+	_strm.avail_in = 0;
+	
+	return (_problem.empty() ? nCopied : 0);
+}
+#endif
+
+/** \brief Read a chunk of sequence
+ *
+ * Positions past the end of the file are set to _N_. Problems are left in the reader for the caller to check.
+ *
+ * \param[in] reader sequence file reader
+ * \param[in] offset zero-based chunk start
+ * \param[out] buf chunk buffer
+ * \param[in] len chunk length
+ */
+static void readSeqChunk(SeqReader &reader, const size_t &offset, char *buf, const size_t &len){
+	const size_t nRead = reader.read(offset, buf, len);
+	for (size_t iCh = nRead; iCh < len; iCh++) {
+		buf[iCh] = 'N';
+	}
+	for (size_t iCh = 0; iCh < nRead; iCh++) { // an end of line is also past the end of the sequence
+		if (buf[iCh] == '\n') {
+			fill(buf + iCh, buf + len, 'N');
+			break;
+		}
+	}
+}
+
+/** \brief Read a chunk from each of several sequence files
+ *
+ * Runs _readOne_ for the index of each reader. A gzip file is inflated by one thread from the start, so with gzip input the readers are shared with helper threads borrowed from the pool the BGZF readers use, if cores are free. Once all the reads are done, stops on the first reader with a problem.
+ *
+ * \param[in] readers sequence file readers
+ * \param[in] readOne function that reads the chunk of the reader with the given index
+ */
+template <typename ReadFun>
+static void readEach(const vector<SeqReader*> &readers, ReadFun readOne){
+	unsigned int nHelpers = 0;
+#ifdef USE_ZLIB
+	unsigned int nGzip = 0;
+	for (auto rdIt = readers.begin(); rdIt != readers.end(); ++rdIt) {
+		nGzip += (*rdIt)->gzip();
+	}
+	if (nGzip > 1) {
+		nHelpers = borrowHelpers(nGzip - 1); // the calling thread does its share
+	}
+#endif
+	atomic<size_t> nextReader(0);
+	auto readShare = [&readers, &readOne, &nextReader](){
+		size_t iRdr;
+		while ( (iRdr = nextReader++) < readers.size() ) {
+			readOne(iRdr);
+		}
+	};
+	vector<thread> helpers;
+	for (unsigned int iHlp = 0; iHlp < nHelpers; iHlp++) {
+		helpers.push_back( thread(readShare) );
+	}
+	readShare();
+	for (auto thrIt = helpers.begin(); thrIt != helpers.end(); ++thrIt) {
+		thrIt->join();
+	}
+#ifdef USE_ZLIB
+	nInflateHelpers -= nHelpers;
+#endif
+	for (auto rdIt = readers.begin(); rdIt != readers.end(); ++rdIt) {
+		(*rdIt)->stopOnProblem();
+	}
+}
+
+/** \brief Result of a preflight file check
+ *
+ * Size, modification time and sequence length of an input file, or a description of what is wrong with it.
+ */
+struct FileCheck {
+	/// File size
+	uint64_t size;
+	/// Modification time
+	int64_t mtime;
+	/// Sequence length, not counting a trailing end of line
+	uint64_t seqLength;
+	/// Problem found; empty if the file is fine
+	string problem;
+};
+
+/** \brief Find an invalid nucleotide
+ *
+ * Uses SSE2 comparisons sixteen bytes at a time where available.
+ *
+ * \param[in] buf sequence
+ * \param[in] len sequence length
+ *
+ * \return position of the first byte that is not _A_, _C_, _G_, _T_ or _N_; _len_ if there is none
+ */
+static size_t firstBadByte(const char *buf, const size_t &len){
+	size_t pos = 0;
+#ifdef __SSE2__
+	const __m128i nucA = _mm_set1_epi8('A');
+	const __m128i nucC = _mm_set1_epi8('C');
+	const __m128i nucG = _mm_set1_epi8('G');
+	const __m128i nucT = _mm_set1_epi8('T');
+	const __m128i nucN = _mm_set1_epi8('N');
+	for (; pos + 16 <= len; pos += 16) {
+		const __m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i*>(buf + pos) );
+		const __m128i valid = _mm_or_si128( _mm_or_si128( _mm_or_si128(_mm_cmpeq_epi8(block, nucA), _mm_cmpeq_epi8(block, nucC)), _mm_or_si128(_mm_cmpeq_epi8(block, nucG), _mm_cmpeq_epi8(block, nucT)) ), _mm_cmpeq_epi8(block, nucN) );
+		if (_mm_movemask_epi8(valid) != 0xFFFF) { // the scalar loop finds the exact position
+			break;
+		}
+	}
+#endif
+	for (; pos < len; pos++) {
+		const char nuc = buf[pos];
+		if ( (nuc != 'A') && (nuc != 'C') && (nuc != 'G') && (nuc != 'T') && (nuc != 'N') ) {
+			break;
+		}
+	}
+	
+	return pos;
+}
+
+/** \brief Check a sequence file
+ *
+ * Scans the file for characters other than nucleotides. Only a single end of line at the very end of the file is allowed.
+ * Compressed files are checked after decompression, so byte positions and the sequence length are uncompressed.
+ *
+ * \param[in] flName file name
+ * \param[in,out] check file check with the (compressed) size already set; the sequence length or the problem is filled in
+ */
+static void scanSeqFile(const string &flName, FileCheck &check){
+	SeqReader reader(flName);
+	vector<char> buf(4194304);
+	uint64_t offset = 0;
+	size_t nRead    = 0;
+	while ( (nRead = reader.read(offset, buf.data(), buf.size())) > 0 ) {
+		const size_t badPos = firstBadByte(buf.data(), nRead);
+		if (badPos < nRead) {
+			if ( (buf[badPos] == '\n') && (badPos + 1 == nRead) && (reader.read(offset + nRead, buf.data(), 1) == 0) && reader.problem().empty() ) { // trailing end of line
+				check.seqLength = offset + badPos;
+				return;
+			}
+			if ( !reader.problem().empty() ) {
+				break;
+			}
+			if (buf[badPos] == '\n') {
+				check.problem = "end of line at byte " + to_string(offset + badPos) + " before the end of the file";
+			} else {
+				check.problem = "invalid character (code " + to_string( static_cast<unsigned int>( static_cast<unsigned char>(buf[badPos]) ) ) + ") at byte " + to_string(offset + badPos);
+			}
+			return;
+		}
+		offset += nRead;
+	}
+	if ( !reader.problem().empty() ) { // recorded rather than fatal, so that the problems of all files are reported
+		check.problem = reader.problem();
+		return;
+	}
+	check.seqLength = offset;
+}
+
+/** \brief Load a preflight manifest
+ *
+ * \param[in] manifestName manifest file name
+ * \param[out] checked files that passed the checks, by name
+ */
+static void loadManifest(const string &manifestName, unordered_map<string, FileCheck> &checked){
+	ifstream mfstIn(manifestName.c_str(), ios::binary);
+	if (!mfstIn) {
+		return;
+	}
+	char tag[4];
+	uint32_t version = 0;
+	uint32_t nFiles  = 0;
+	mfstIn.read(tag, 4);
+	mfstIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	mfstIn.read(reinterpret_cast<char*>(&nFiles), sizeof(uint32_t));
+	if ( !mfstIn || (string(tag, 4) != "A2BM") || (version != 1) ) {
+		return;
+	}
+	for (uint32_t iFl = 0; iFl < nFiles; iFl++) {
+		uint32_t nameLen = 0;
+		mfstIn.read(reinterpret_cast<char*>(&nameLen), sizeof(uint32_t));
+		if ( !mfstIn || (nameLen > 65536) ) {
+			return;
+		}
+		string name(nameLen, ' ');
+		FileCheck check;
+		mfstIn.read(&name[0], nameLen);
+		mfstIn.read(reinterpret_cast<char*>(&check.size), sizeof(uint64_t));
+		mfstIn.read(reinterpret_cast<char*>(&check.mtime), sizeof(int64_t));
+		mfstIn.read(reinterpret_cast<char*>(&check.seqLength), sizeof(uint64_t));
+		if (!mfstIn) {
+			return;
+		}
+		checked[name] = check;
+	}
+}
+
+/** \brief Save a preflight manifest
+ *
+ * \param[in] manifestName manifest file name
+ * \param[in] files file names
+ * \param[in] checks file checks, in the same order as the names
+ */
+static void saveManifest(const string &manifestName, const vector<string> &files, const vector<FileCheck> &checks){
+	const string tmpName   = manifestName + ".tmp" + to_string( getpid() ); // several processes (e.g., shards) may save the same manifest
+	const uint32_t version = 1;
+	const uint32_t nFiles  = files.size();
+	ofstream mfstOut(tmpName.c_str(), ios::binary | ios::trunc);
+	if (!mfstOut) {
+		return; // the manifest only saves time; not being able to write it is not an error
+	}
+	mfstOut.write("A2BM", 4);
+	mfstOut.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	mfstOut.write(reinterpret_cast<const char*>(&nFiles), sizeof(uint32_t));
+	for (size_t iFl = 0; iFl < files.size(); iFl++) {
+		const uint32_t nameLen = files[iFl].size();
+		mfstOut.write(reinterpret_cast<const char*>(&nameLen), sizeof(uint32_t));
+		mfstOut.write(files[iFl].c_str(), nameLen);
+		mfstOut.write(reinterpret_cast<const char*>(&checks[iFl].size), sizeof(uint64_t));
+		mfstOut.write(reinterpret_cast<const char*>(&checks[iFl].mtime), sizeof(int64_t));
+		mfstOut.write(reinterpret_cast<const char*>(&checks[iFl].seqLength), sizeof(uint64_t));
+	}
+	mfstOut.close();
+	if ( !mfstOut || (rename(tmpName.c_str(), manifestName.c_str()) != 0) ) {
+		remove(tmpName.c_str());
+	}
+}
+
+void SFparse::_preflight(){
+	vector<string> files(1, _refFlName);
+	files.insert(files.end(), _inFileNames.begin(), _inFileNames.end());
+	const string manifestName = _outFileName + ".mfst";
+	unordered_map<string, FileCheck> checked;
+	loadManifest(manifestName, checked);
+	
+	// files are handed out to the threads one at a time
+	vector<FileCheck> checks(files.size());
+	vector<char> scanned(files.size(), 0);
+	atomic<size_t> nextFile(0);
+	const unsigned int nCores = thread::hardware_concurrency();
+	const size_t nThreads     = ( (nCores ? nCores : 1) < files.size() ? (nCores ? nCores : 1) : files.size() );
+	vector<thread> checkers;
+	for (size_t iThr = 0; iThr < nThreads; iThr++) {
+		checkers.push_back(thread([&files, &checks, &scanned, &checked, &nextFile](){
+			size_t iFl;
+			while ( (iFl = nextFile++) < files.size() ) {
+				FileCheck &check = checks[iFl];
+				check.size       = 0;
+				check.mtime      = 0;
+				check.seqLength  = 0;
+				struct stat flStat;
+				if (stat(files[iFl].c_str(), &flStat) != 0) {
+					check.problem = "cannot be read";
+					continue;
+				}
+				check.size  = flStat.st_size;
+				check.mtime = flStat.st_mtime;
+				auto chkIt  = checked.find(files[iFl]);
+				if ( (chkIt != checked.end()) && (chkIt->second.size == check.size) && (chkIt->second.mtime == check.mtime) ) {
+					check.seqLength = chkIt->second.seqLength;
+					continue;
+				}
+				scanSeqFile(files[iFl], check);
+				scanned[iFl] = 1;
+			}
+		}));
+	}
+	for (auto thrIt = checkers.begin(); thrIt != checkers.end(); ++thrIt) {
+		thrIt->join();
+	}
+	
+	const uint64_t refLength = checks[0].seqLength;
+	bool failed = false;
+	for (size_t iFl = 0; iFl < files.size(); iFl++) {
+		if ( checks[iFl].problem.empty() && checks[0].problem.empty() && (checks[iFl].seqLength != refLength) ) {
+			checks[iFl].problem = "sequence length " + to_string(checks[iFl].seqLength) + " differs from the reference length " + to_string(refLength);
+		}
+		if ( !checks[iFl].problem.empty() ) {
+			cerr << "ERROR: input file " << (files[iFl].empty() ? "(no reference)" : files[iFl]) << ": " << checks[iFl].problem << endl;
+			failed = true;
+		}
+	}
+	if (failed) {
+		cerr << "ERROR: input files for " << _chromName << " failed the checks in SFparse()" << endl;
+		exit(5);
+	}
+	_refLength = refLength;
+	if ( find(scanned.begin(), scanned.end(), 1) != scanned.end() ) {
+		saveManifest(manifestName, files, checks);
+	}
+}
+
+SFparse::SFparse(const vector<string> &inFlNam, const vector<string> &lineNames, const string &refFlNam, const string &outFlNam, const string &chrNam, const unsigned short &chrNum, const string &inFlType, const string &outFlType, const unsigned long &alloc) : _inFileNames(inFlNam), _lineNames(lineNames), _refFlName(refFlNam), _outFileName(outFlNam), _chromName(chrNam), _chromNum(chrNum), _inFileType(inFlType), _outFileType(outFlType), _bufAlloc(alloc), _indexOut(false), _shard(0), _nShards(1), _genomeWide(false), _nSNP(0), _checkpoint(false), _incremental(false), _bgzfThreads(0), _refLength(0), _dedupWindow(0), _winSize(0), _winStep(0) {
+	auto outIt = _outFileName.end();
+	if ( *(outIt - 4) == '.') { // there is a potentially valid extension
+		_outFileName.erase(outIt - 4, outIt); // erase the extension
+	}
+	if (_inFileType == "SEQ") {
+		_preflight();
+	}
+}
+
+SFparse::SFparse(const string &fileList, const string &outFlNam, const string &chrNam, const unsigned short &chrNum, const string &inFlType, const string &outFlType, const unsigned long &alloc) : _outFileName(outFlNam), _chromName(chrNam), _chromNum(chrNum), _inFileType(inFlType), _outFileType(outFlType), _bufAlloc(alloc), _indexOut(false), _shard(0), _nShards(1), _genomeWide(false), _nSNP(0), _checkpoint(false), _incremental(false), _bgzfThreads(0), _refLength(0), _dedupWindow(0), _winSize(0), _winStep(0) {
+	auto outIt = _outFileName.end();
+	if ( *(outIt - 4) == '.') { // there is a potentially valid extension
+		_outFileName.erase(outIt - 4, outIt); // erase the extension
+	}
+	
+	ifstream lstIn(fileList.c_str());
+	
+	if (!lstIn) {
+		cerr << "ERROR: cannot open file " << fileList << " listing files to process in SFsparse constructor" << endl;
+		exit(1);
+	}
+	string eachFile;
+	while (getline(lstIn, eachFile)) {
+		if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
+			eachFile.erase(0, 2);
+			_refFlName = eachFile;
+		} else {
+			_inFileNames.push_back(eachFile);
+		}
+		
+	}
+	lstIn.close();
+	if (_inFileNames.size() > numeric_limits<unsigned short>::max()) {
+		cerr << "WARNING: number of lines " << _inFileNames.size() << " larger than allowed (" << numeric_limits<unsigned short>::max() << ")" << endl;
+	}
+	
+	for (auto flIt = _inFileNames.begin(); flIt != _inFileNames.end(); ++flIt) {
+		string locNam;
+		for (size_t pos = 0; pos < flIt->size(); pos++) {
+			if ( ((*flIt)[pos] == '/') || ((*flIt)[pos] == '\\') ) { // strip out *nix or Windows directory markers
+				locNam.clear();
+				continue;
+			}
+			if ( ((*flIt)[pos] == '_') || ((*flIt)[pos] == '.') ) {
+				break;
+			}
+			locNam += (*flIt)[pos];
+		}
+		_lineNames.push_back(locNam);
+	}
+	if (_inFileType == "SEQ") {
+		_preflight();
+	}
+}
+
+SFparse::SFparse(const string &fileList, const string &outFlNam, const unsigned long &alloc) : _outFileName(outFlNam), _bufAlloc(alloc), _indexOut(false), _shard(0), _nShards(1), _genomeWide(false), _nSNP(0), _checkpoint(false), _incremental(false), _bgzfThreads(0), _refLength(0), _dedupWindow(0), _winSize(0), _winStep(0) {
+	string ext;
+	bool foundDot = false;
+	for (size_t pos = _outFileName.size() - 1; pos > 0; pos--) {
+		if (foundDot) {
+			if (_outFileName[pos] == '_') {
+				break;
+			}
+			_chromName = _outFileName[pos] + _chromName;
+			
+		}
+		if (_outFileName[pos] == '.') {
+			foundDot = true;
+		}
+		if (!foundDot) {
+			ext = _outFileName[pos] + ext;
+		}
+	}
+	if (!foundDot) {
+		cerr << "ERROR: no extension found in file " << _outFileName << " in SFparse extension-based constructor" << endl;
+		exit(2);
+	}
+	if (_chromName.empty()) {
+		cerr << "WARNING: no chromosome name found in output file name " << _outFileName << " in SFsparse constructor; setting default" << endl;
+		_chromName = "NN";
+		_chromNum  = 0;
+	} else {
+		_chromNum = 1;
+	}
+	if (ext == "bvt") {
+		_outFileType = "BVT";
+	} else if (ext == "bed") {
+		_outFileType = "BED";
+	} else {
+		cerr << "ERROR: unknown extension " << ext << " for output file in SFparse extension-based constructor" << endl;
+		exit(3);
+	}
+	ext.clear();
+	auto outIt = _outFileName.end();
+	_outFileName.erase(outIt - 4, outIt); // erase the extension
+	
+	ifstream lstIn(fileList.c_str());
+	
+	if (!lstIn) {
+		cerr << "ERROR: cannot open file " << fileList << " listing files to process in SFsparse extension-based constructor" << endl;
+		exit(1);
+	}
+	string eachFile;
+	getline(lstIn, eachFile);
+	foundDot = false;
+	for (size_t pos = eachFile.size() - 1; pos > 0; pos--) {
+		if (eachFile[pos] == '.') {
+			foundDot = true;
+			break;
+		}
+		ext = eachFile[pos] + ext;
+	}
+	if ( (ext == "gz") || (ext == "bgz") ) { // compressed input; the type comes from the extension before the compression one
+		const size_t typeEnd = eachFile.size() - ext.size() - 1;
+		ext.clear();
+		for (size_t pos = typeEnd; pos > 0; pos--) {
+			if (eachFile[pos - 1] == '.') {
+				break;
+			}
+			ext = eachFile[pos - 1] + ext;
+		}
+	}
+	if (ext == "seq") {
+		_inFileType = "SEQ";
+	} else {
+		cerr << "ERROR: unknown extension " << ext << " for input files in SFparse extension-based constructor" << endl;
+		exit(3);
+	}
+	
+	if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
+		eachFile.erase(0, 2);
+		_refFlName = eachFile;
+	} else {
+		_inFileNames.push_back(eachFile);
+	}
+	while (getline(lstIn, eachFile)) {
+		if ( (eachFile[0] == 'r') && (eachFile[1] == ':') ) {
+			eachFile.erase(0, 2);
+			_refFlName = eachFile;
+		} else {
+			_inFileNames.push_back(eachFile);
+		}
+	}
+	
+	lstIn.close();
+	
+	for (auto flIt = _inFileNames.begin(); flIt != _inFileNames.end(); ++flIt) {
+		string locNam;
+		for (size_t pos = 0; pos < flIt->size(); pos++) {
+			if ( ((*flIt)[pos] == '/') || ((*flIt)[pos] == '\\') ) { // strip out *nix or Windows directory markers
+				locNam.clear();
+				continue;
+			}
+			if ( ((*flIt)[pos] == '_') || ((*flIt)[pos] == '.') ) {
+				break;
+			}
+			locNam += (*flIt)[pos];
+		}
+		_lineNames.push_back(locNam);
+	}
+	
+	if (_inFileNames.size() > numeric_limits<unsigned int>::max()) {
+		cerr << "WARNING: number of lines " << _inFileNames.size() << " larger than allowed (" << numeric_limits<unsigned int>::max() << ")" << endl;
+	}
+	if (_inFileType == "SEQ") {
+		_preflight();
+	}
+}
+SFparse& SFparse::operator=(const SFparse &inObj){
+	if (this != &inObj) {
+		_inFileNames = inObj._inFileNames;
+		_lineNames   = inObj._lineNames;
+		_refFlName   = inObj._refFlName;
+		_outFileName = inObj._outFileName;
+		_inFileType  = inObj._inFileType;
+		_outFileType = inObj._outFileType;
+		_chromName   = inObj._chromName;
+		_chromNum    = inObj._chromNum;
+		_bufAlloc    = inObj._bufAlloc;
+		_indexOut    = inObj._indexOut;
+		_shard       = inObj._shard;
+		_nShards     = inObj._nShards;
+		_genomeWide  = inObj._genomeWide;
+		_bedRows     = inObj._bedRows;
+		_bimRows     = inObj._bimRows;
+		_nSNP        = inObj._nSNP;
+		_checkpoint  = inObj._checkpoint;
+		_incremental = inObj._incremental;
+		_bgzfThreads = inObj._bgzfThreads;
+		_refLength   = inObj._refLength;
+		_dedupWindow = inObj._dedupWindow;
+		_winSize     = inObj._winSize;
+		_winStep     = inObj._winStep;
+		
+	}
+	
+	return *this;
+}
+
+SFparse& SFparse::operator=(SFparse &&inObj){
+	if (this != &inObj) {
+		_inFileNames = move(inObj._inFileNames);
+		_lineNames   = move(inObj._lineNames);
+		_refFlName   = move(inObj._refFlName);
+		_outFileName = move(inObj._outFileName);
+		_inFileType  = move(inObj._inFileType);
+		_outFileType = move(inObj._outFileType);
+		_chromName   = move(inObj._chromName);
+		_chromNum    = move(inObj._chromNum);
+		_bufAlloc    = move(inObj._bufAlloc);
+		_indexOut    = move(inObj._indexOut);
+		_shard       = move(inObj._shard);
+		_nShards     = move(inObj._nShards);
+		_genomeWide  = move(inObj._genomeWide);
+		_bedRows     = move(inObj._bedRows);
+		_bimRows     = move(inObj._bimRows);
+		_nSNP        = move(inObj._nSNP);
+		_checkpoint  = move(inObj._checkpoint);
+		_incremental = move(inObj._incremental);
+		_bgzfThreads = move(inObj._bgzfThreads);
+		_refLength   = move(inObj._refLength);
+		_dedupWindow = move(inObj._dedupWindow);
+		_winSize     = move(inObj._winSize);
+		_winStep     = move(inObj._winStep);
+		
+	}
+	
+	return *this;
+}
+
+uint64_t SFparse::inputSize() const {
+	uint64_t totSize = fileSize(_refFlName);
+	for (auto flnIt = _inFileNames.begin(); flnIt != _inFileNames.end(); ++flnIt) {
+		totSize += fileSize(*flnIt);
+	}
+	
+	return totSize;
+}
+
+void SFparse::setShard(const unsigned int &shard, const unsigned int &nShards){
+	if ( (nShards == 0) || (shard >= nShards) ) {
+		cerr << "ERROR: shard " << shard << " out of " << nShards << " is not valid in SFparse::setShard()" << endl;
+		exit(4);
+	}
+	_shard   = shard;
+	_nShards = nShards;
+}
+
+uint64_t SFparse::_inputHash() const {
+	// FNV-1a over the run settings and the name, size and modification time of every input file
+	string runDesc = _chromName + " " + to_string(_chromNum) + " " + to_string(_shard) + " " + to_string(_nShards) + "\n";
+	vector<string> allFiles(1, _refFlName);
+	allFiles.insert(allFiles.end(), _inFileNames.begin(), _inFileNames.end());
+	for (auto flIt = allFiles.begin(); flIt != allFiles.end(); ++flIt) {
+		struct stat flStat;
+		if (stat(flIt->c_str(), &flStat) != 0) {
+			cerr << "ERROR: unable to open file " << *flIt << " in SFparse()" << endl;
+			exit(5);
+		}
+		runDesc += *flIt + " " + to_string(flStat.st_size) + " " + to_string(flStat.st_mtime) + "\n";
+	}
+	uint64_t hash = 14695981039346656037ULL;
+	for (auto chIt = runDesc.begin(); chIt != runDesc.end(); ++chIt) {
+		hash ^= static_cast<unsigned char>(*chIt);
+		hash *= 1099511628211ULL;
+	}
+	
+	return hash;
+}
+
+void SFparse::_writeShardHeader(ofstream &outBed, const uint64_t &firstPos, const uint64_t &endPos) const {
+	const uint32_t version = 1;
+	const uint64_t nSNP    = 0; // filled in when the shard is done
+	const uint32_t shard   = _shard;
+	const uint32_t nShards = _nShards;
+	const uint64_t nLines  = _lineNames.size();
+	const uint32_t nameLen = _chromName.size();
+	outBed.write("A2BF", 4);
+	outBed.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	outBed.write(reinterpret_cast<const char*>(&nSNP), sizeof(uint64_t));
+	outBed.write(reinterpret_cast<const char*>(&shard), sizeof(uint32_t));
+	outBed.write(reinterpret_cast<const char*>(&nShards), sizeof(uint32_t));
+	outBed.write(reinterpret_cast<const char*>(&firstPos), sizeof(uint64_t));
+	outBed.write(reinterpret_cast<const char*>(&endPos), sizeof(uint64_t));
+	outBed.write(reinterpret_cast<const char*>(&nLines), sizeof(uint64_t));
+	outBed.write(reinterpret_cast<const char*>(&_chromNum), sizeof(unsigned short));
+	outBed.write(reinterpret_cast<const char*>(&nameLen), sizeof(uint32_t));
+	outBed.write(_chromName.c_str(), nameLen);
+}
+
+void SFparse::operator()(){
+	if ( (_inFileType == "SEQ") && (_outFileType == "BVT") ) {
+		if ( (_nShards > 1) || _genomeWide ) {
+			cerr << "ERROR: sharding and genome-wide output are only implemented for BED" << endl;
+			exit(4);
+		}
+		size_t bufSize = _bufAlloc/(_inFileNames.size() + 1);
+		bool notDone = true;
+		
+		string fullOutName   = _outFileName + ".bvt";
+		string outMetaFlName = _outFileName + ".bvtm";
+		ofstream outMeta(outMetaFlName);
+		if (!outMeta) {
+			cerr << "ERROR: unable to open file " << outMetaFlName << " for metadata output in SFparse()" << endl;
+			exit(6);
+		}
+		outMeta << _chromName << flush;
+		for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
+			outMeta << " " << *lnNamIt << flush;
 		}
 		outMeta << endl;
 		outMeta.close();
 		
-		ifstream inRef;
+		SeqReader inRef(_refFlName);
 		
-		vector<ifstream> inSeqs(_inFileNames.size());
+		vector<SeqReader*> inSeqs;
+		for (auto flnIt = _inFileNames.begin(); flnIt != _inFileNames.end(); ++flnIt) {
+			inSeqs.push_back( new SeqReader(*flnIt) );
+		}
 		vector<char*> seqBufs(_inFileNames.size());
 		
 		remove(fullOutName.c_str());
@@ -267,278 +1650,2200 @@ void SFparse::operator()(){
 		
 		/*
 		 *  There is a limit on how many files can be open at the same time
-		 *  I have to close the SEQ files after reading each chunk; endPos is the place I save where I am to return to in the next iteration (if any)
+		 *  The readers open plain SEQ files anew for each chunk; endPos is the place I save where I am to return to in the next iteration (if any)
 		 */
 		size_t endPosR      = 0;
 		size_t endPosS      = 0;
 		unsigned int chrPos = 1;
 		
-		// Read the FASTA files into the buffers, iterate until end of file is reached in the reference (this means that if, contrary to expectation, the sample files are longer they will be truncated)
-		while (notDone) {
-			char *refBuf = new char[bufSize]; // one extra for the null terminator
-			inRef.open(_refFlName.c_str());
-			if (!inRef) {
-				cerr << "ERROR: unable to open reference file " << _refFlName << " in SFparse()" << endl;
-				exit(5);
-				
-			}
-			
-			if (endPosR) {
-				inRef.seekg(endPosR);
+		// Read the FASTA files into the buffers, iterate until end of file is reached in the reference (this means that if, contrary to expectation, the sample files are longer they will be truncated)
+		while (notDone) {
+			char *refBuf = new char[bufSize]; // one extra for the null terminator
+			const size_t nRead = inRef.getLine(endPosR, refBuf, bufSize);
+			inRef.stopOnProblem();
+			if (nRead < bufSize - 1) { // did we read to the end?
+				bufSize = nRead + 1;
+				notDone = false;
+			}
+			endPosS  = endPosR; // save the previous state of endPosR to read the population sample file
+			endPosR += nRead;   // save position
+			
+			for (auto sqbIt = seqBufs.begin(); sqbIt != seqBufs.end(); ++sqbIt) {
+				*sqbIt = new char[bufSize];
+			}
+			readEach(inSeqs, [&inSeqs, &seqBufs, endPosS, bufSize](const size_t &iSeq){
+				inSeqs[iSeq]->getLine(endPosS, seqBufs[iSeq], bufSize);
+			});
+			
+			char *polyLine = new char[_inFileNames.size() + 1];
+			for (size_t i = 0; i < (bufSize - 1); i++) {
+				bool polymorphic = false;
+				polyLine[0] = refBuf[i];
+				unsigned int iLine = 1;
+				refBuf[i] = seqBufs[0][i]; // only looking for sites polymorphic within the sample; ones only divergent from reference not counted; therefore, the genotype of the i-th nucleotide for the first line is set to reference
+				for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); sbIt++) {
+					polyLine[iLine] = (*sbIt)[i];
+					iLine++;
+					if (refBuf[i] == 'N') {
+						refBuf[i] = (*sbIt)[i];
+					}
+					if ( ((*sbIt)[i] != 'N') && ((*sbIt)[i] != refBuf[i]) ) { // if reference was missing, polymorphic definitely not set to true for this line
+						polymorphic = true;
+					}
+				}
+				if (polymorphic) {
+					outDat.write(reinterpret_cast<char*>(&chrPos), sizeof(unsigned int));
+					outDat.write(polyLine, _inFileNames.size() + 1);
+				}
+				chrPos++;
+			}
+			
+			delete [] polyLine;
+			
+			for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); ++sbIt) {
+				delete [] *sbIt;
+			}
+			delete [] refBuf;
+		}
+		
+		outDat.close();
+		for (auto isfIt = inSeqs.begin(); isfIt != inSeqs.end(); ++isfIt) {
+			delete *isfIt;
+		}
+		
+	} else if ( (_inFileType == "SEQ") && (_outFileType == "BED") ) {
+		// shards are saved as fragments, e.g. snp_Chr2L.s3of16.bed
+		const string outBase = (_nShards > 1 ? _outFileName + ".s" + to_string(_shard) + "of" + to_string(_nShards) : _outFileName);
+		string outBedName = outBase + ".bed";
+		string outBimName = outBase + ".bim";
+		string outFamName = outBase + ".fam";
+		
+		if (_genomeWide) {
+			if (_nShards > 1) {
+				cerr << "ERROR: shards cannot be saved genome-wide; use mergeShards() instead" << endl;
+				exit(4);
+			}
+			_bedRows.clear();
+			_bimRows.clear();
+			BEDwriter bedWriter(_bedRows, _bimRows, _chromNum, _chromName);
+			_windowedScan(bedWriter);
+			_nSNP = bedWriter.nSNP();
+			
+			return;
+		}
+		
+		if (_dedupWindow) {
+			if ( (_nShards > 1) || _incremental ) {
+				cerr << "ERROR: deduplicated BED output cannot be sharded or updated incrementally" << endl;
+				exit(4);
+			}
+			const string outDbedName = outBase + ".dbed";
+			// outputs of an earlier ordinary run would not match the new .bim file, and PLINK would pair a stale .bed with it
+			remove(outBedName.c_str());
+			remove((_outFileName + ".bpi").c_str());
+			remove((outBase + ".sum").c_str());
+			remove((outBase + ".ckpt").c_str());
+			ofstream outFam(outFamName);
+			if (!outFam) {
+				cerr << "ERROR: unable to open .fam file " << outFamName << " for output in SFparse()" << endl;
+				exit(6);
+			}
+			for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
+				outFam << *lnNamIt << " " << *lnNamIt << " 0 0 0 -9" << endl;
+			}
+			outFam.close();
+			ofstream outDbed(outDbedName, ios::binary | ios::trunc);
+			if (!outDbed) {
+				cerr << "ERROR: unable to open BED file " << outDbedName << " for data output in SFparse()" << endl;
+				exit(6);
+			}
+			ofstream outBim(outBimName, ios::trunc);
+			if (!outBim) {
+				cerr << "ERROR: unable to open .bim file " << outBimName << " for data output in SFparse()" << endl;
+				exit(6);
+			}
+			char magicBytes[] = {0x6C, 0x1B, 0x1}; // the unique rows make a valid BED file
+			outDbed.write(magicBytes, 3);
+			BEDdedup dedupWriter(outDbed, outBim, _chromNum, _chromName, _dedupWindow);
+			_windowedScan(dedupWriter);
+			outDbed.close();
+			outBim.close();
+			dedupWriter.savePatternIndex(outBase + ".pid");
+			// there is no .bed file for a .bpi index to point into; the index is saved when the BED file is expanded
+			
+			return;
+		}
+		// deduplicated outputs of an earlier run would not match the new .bim file
+		remove((outBase + ".dbed").c_str());
+		remove((outBase + ".pid").c_str());
+		
+		// existing incremental output only needs the added lines
+		const string sumName = outBase + ".sum";
+		if (_incremental) {
+			if (_winSize) {
+				cerr << "ERROR: window summaries cannot be combined with incremental output" << endl;
+				exit(4);
+			}
+			if (_nShards > 1) {
+				cerr << "ERROR: sharded output cannot be updated incrementally" << endl;
+				exit(4);
+			}
+			SiteSummary oldSum;
+			if ( loadSummary(sumName, oldSum) ) {
+				if ( _updateBED(oldSum, outBedName, outBimName, outFamName, sumName) ) {
+					if (_indexOut) {
+						BEDindex bedIdx(outBimName, outFamName);
+						bedIdx.save(_outFileName + ".bpi");
+					}
+					return;
+				}
+				cerr << "WARNING: site summary " << sumName << " does not match the current inputs or outputs; converting all lines" << endl;
+			}
+		}
+		
+		// a checkpoint from an interrupted run with the same inputs lets us pick up where it stopped; incremental runs and window summaries start over because they need the full scan
+		const bool useCkpt    = _checkpoint && !_incremental && !_winSize;
+		const string ckptName = outBase + ".ckpt";
+		if (_checkpoint && !_incremental && _winSize) {
+			cerr << "WARNING: window summaries need the full scan; " << outBedName << " is not checkpointed and an interrupted run starts over" << endl;
+		}
+		Checkpoint state      = {0, 0, 0, 0, 0};
+		bool resume           = false;
+		if (useCkpt) {
+			const uint64_t inHash = _inputHash();
+			if ( loadCheckpoint(ckptName, state) ) {
+				resume = (state.inputHash == inHash) && (fileSize(outBedName) >= state.bedLength) && (fileSize(outBimName) >= state.bimLength);
+				if (!resume) {
+					cerr << "WARNING: checkpoint " << ckptName << " does not match the current inputs or outputs; starting over" << endl;
+					state = {0, 0, 0, 0, 0};
+				}
+			}
+			state.inputHash = inHash;
+		}
+		
+		// first save the .fam file
+		ofstream outFam(outFamName);
+		if (!outFam) {
+			cerr << "ERROR: unable to open .fam file " << outFamName << " for output in SFparse()" << endl;
+			exit(6);
+		}
+		for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
+			outFam << *lnNamIt << " " << *lnNamIt << " 0 0 0 -9" << endl;
+		}
+		outFam.close();
+		
+		ofstream outBed;
+		ofstream outBim;
+		if (resume) {
+			// drop anything written after the last checkpoint and append from there
+			if ( (truncate(outBedName.c_str(), state.bedLength) != 0) || (truncate(outBimName.c_str(), state.bimLength) != 0) ) {
+				cerr << "ERROR: unable to truncate output files to the checkpoint in " << ckptName << " in SFparse()" << endl;
+				exit(6);
+			}
+			outBed.open(outBedName, ios::binary | ios::in | ios::out);
+			outBim.open(outBimName, ios::binary | ios::in | ios::out);
+			outBed.seekp(0, ios::end);
+			outBim.seekp(0, ios::end);
+		} else {
+			remove(outBedName.c_str());
+			outBed.open(outBedName, ios::binary);
+			remove(outBimName.c_str());
+			outBim.open(outBimName);
+		}
+		if (!outBed) {
+			cerr << "ERROR: unable to open BED file " << outBedName << " for data output in SFparse()" << endl;
+			exit(6);
+		}
+		if (!outBim) {
+			cerr << "ERROR: unable to open .bim file " << outBimName << " for data output in SFparse()" << endl;
+			exit(6);
+		}
+		
+		if (resume) {
+			// the header or magic bytes are already in place
+		} else if (_nShards > 1) {
+			size_t sliceBeg = 0;
+			size_t sliceEnd = 0;
+			_slice(sliceBeg, sliceEnd);
+			_writeShardHeader(outBed, sliceBeg + 1, sliceEnd + 1);
+		} else {
+			char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+			outBed.write(magicBytes, 3);
+		}
+		
+		BEDwriter bedWriter(outBed, outBim, _chromNum, _chromName);
+		uint64_t nSNP = 0;
+		SiteSummary summary;
+		remove(sumName.c_str()); // a summary left from an earlier run no longer matches the output
+		if (_incremental) {
+			summary.chromName = _chromName;
+			summary.files.push_back(_refFlName);
+			summary.files.insert(summary.files.end(), _inFileNames.begin(), _inFileNames.end());
+			summary.sizes.resize( summary.files.size() );
+			summary.mtimes.resize( summary.files.size() );
+			for (size_t iFl = 0; iFl < summary.files.size(); iFl++) {
+				fileStamp(summary.files[iFl], summary.sizes[iFl], summary.mtimes[iFl]);
+			}
+			_windowedScan(bedWriter, &summary);
+			nSNP = bedWriter.nSNP();
+		} else if (useCkpt) {
+			BEDcheckpoint ckptWriter(bedWriter, outBed, outBim, outBedName, outBimName, ckptName, state);
+			_biallelicScan(ckptWriter, state.nextOffset);
+			nSNP = ckptWriter.nSNP();
+		} else {
+			_windowedScan(bedWriter);
+			nSNP = bedWriter.nSNP();
+		}
+		
+		if (_nShards > 1) {
+			outBed.seekp(8); // the SNP count follows the tag and version
+			outBed.write(reinterpret_cast<char*>(&nSNP), sizeof(uint64_t));
+		}
+		outBed.close();
+		outBim.close();
+		if (useCkpt) {
+			remove(ckptName.c_str());
+		}
+		if (_incremental) {
+			saveSummary(sumName, summary);
+		}
+		
+		if (_indexOut && (_nShards == 1) ) {
+			BEDindex bedIdx(outBimName, outFamName);
+			bedIdx.save(_outFileName + ".bpi");
+		}
+		
+	} else if ( (_inFileType == "SEQ") && (_outFileType == "VCF") ) {
+		if ( (_nShards > 1) || _genomeWide ) {
+			cerr << "ERROR: sharding and genome-wide output are only implemented for BED" << endl;
+			exit(4);
+		}
+		const string outVCFname = _outFileName + (_bgzfThreads ? ".vcf.gz" : ".vcf");
+		ofstream outVCF(outVCFname, ios::binary | ios::trunc);
+		if (!outVCF) {
+			cerr << "ERROR: unable to open VCF file " << outVCFname << " for data output in SFparse()" << endl;
+			exit(6);
+		}
+		VCFwriter vcfWriter(outVCF, _lineNames, _chromName, _bgzfThreads);
+		_windowedScan(vcfWriter);
+		vcfWriter.finish();
+		outVCF.close();
+		
+	} else {
+		cerr << "ERROR: unknown input or output format for parsing" << endl;
+		exit(4);
+	}
+	
+}
+
+
+void SFparse::operator()(SNPvisitor &visitor){
+	if (_inFileType != "SEQ") {
+		cerr << "ERROR: unknown input format for SNP streaming" << endl;
+		exit(4);
+	}
+	_biallelicScan(visitor);
+}
+
+void SFparse::_slice(size_t &sliceBeg, size_t &sliceEnd) const {
+	if (_nShards > 1) {
+		sliceBeg = _refLength*_shard/_nShards;
+		sliceEnd = _refLength*(_shard + 1)/_nShards;
+	} else {
+		sliceBeg = 0;
+		sliceEnd = (_refLength ? _refLength : numeric_limits<size_t>::max()); // with a known length the last chunk is sized exactly
+	}
+}
+
+/** \brief Assign SNP alleles
+ *
+ * Sets the ancestral state, alleles and tag of a SNP record. The alternative allele is the derived allele when the ancestral state matches one of the sample alleles; otherwise the alleles are kept in the order they appear in the sample.
+ *
+ * \param[in,out] rec SNP record
+ * \param[in] anc ancestral state
+ * \param[in] first first non-missing allele in the sample
+ * \param[in] alt the other allele in the sample
+ */
+static void setAlleles(SNPrecord &rec, const char &anc, const char &first, const char &alt){
+	rec.ancestral = anc;
+	if (anc == 'N') { // label the SNP name with 'm' at the end is the ancestral state is missing
+		rec.tag = 'm';
+		rec.alt = alt;
+		rec.ref = first;
+	} else if ( (alt != anc) && (first != anc) ) { // the SNP is biallelic in the sample, but the ancestral state is different from both
+		rec.tag = 'd';
+		rec.alt = alt;
+		rec.ref = first;
+	} else {
+		rec.tag = '\0';
+		rec.alt = (alt == anc ? first : alt); // assign ref to alt if alt is ancestral
+		rec.ref = anc;
+	}
+}
+
+/** \brief Pack genotypes into a BED row
+ *
+ * Genotypes equal to _alt_ are saved as alternative homozygotes, _N_ as missing, and everything else as reference homozygotes.
+ *
+ * \param[in] genotypes genotypes, one nucleotide per line
+ * \param[in] nLines number of lines
+ * \param[in] alt alternative allele
+ * \param[out] bedLine packed BED row; must have room for (_nLines_ + 3)/4 bytes
+ */
+static void packBED(const char *genotypes, const size_t &nLines, const char &alt, char *bedLine){
+	// Bit masks for going from a char array of genotypes to the packed BED format; the positions go in the reverse direction
+	static const char altMask[]  = {static_cast<char>(0xFC), static_cast<char>(0xF3), static_cast<char>(0xCF), static_cast<char>(0x3F)}; // alternative (1/1 in plink)
+	// no need for reference (2/2 in plink) because it will be all ones; doing it this way because SFS is heavy on low-frequency derived alleles and so I will mostly not have to do anything with bitmasks
+	static const char missMask[] = {static_cast<char>(0xFD), static_cast<char>(0xF7), static_cast<char>(0xDF), static_cast<char>(0x7F)}; // missing
+	static const char padMask[]  = {static_cast<char>(0x3F), static_cast<char>(0x0F), static_cast<char>(0x03)};                          // padding
+	const size_t bedLineLen = (nLines + 3)/4;
+	
+	unsigned int remainPad = bedLineLen * 4; // tracks how many genotypes are left in the padded line
+	size_t iGeno = 0;                        // tracks the number of genotypes processed in the char array (it is unpadded)
+	for (size_t iBed = 0; iBed < bedLineLen; iBed++) {
+		bedLine[iBed] = 0xFF;
+		
+		for (unsigned short bytePos = 0; bytePos < 4; bytePos++) { // actually going from the end of the byte, but that is already accounted for in the masks
+			if (genotypes[iGeno] == alt) { // alternative (derived)
+				bedLine[iBed] = bedLine[iBed] & altMask[bytePos];
+			} else if (genotypes[iGeno] == 'N') { // missing
+				bedLine[iBed] = bedLine[iBed] & missMask[bytePos];
+			} // otherwise, it is reference and we do not do anything; no heterozygotes
+			iGeno++;
+			remainPad--;
+			if (iGeno == nLines) {
+				if (remainPad != 0) {
+					bedLine[iBed] = bedLine[iBed] & padMask[remainPad - 1];
+				}
+				break; // that should automatically get us to the end of the outer loop, too
+			}
+		}
+	}
+}
+
+/** \brief Classify sites
+ *
+ * Finds biallelic SNPs among consecutive sites held in memory and passes them to the visitor. Used for both chunks read from files and mapped alignments.
+ *
+ * \param[in] refBuf reference (ancestral) sequence
+ * \param[in] seqBufs sequences of the lines, aligned with the reference
+ * \param[in] nLines number of lines
+ * \param[in] nSites number of sites
+ * \param[in] firstPos chromosome position (1-based) of the first site
+ * \param[out] polyLine genotype buffer with room for _nLines_ nucleotides
+ * \param[out] bedLine BED row buffer with room for (_nLines_ + 3)/4 bytes
+ * \param[in,out] record SNP record pointing to _polyLine_ and _bedLine_
+ * \param[in,out] visitor SNP visitor
+ * \param[out] summary if not _nullptr_, the first and second allele of each site are appended
+ */
+static void scanSites(const char *refBuf, const char * const *seqBufs, const size_t &nLines, const size_t &nSites, const unsigned int &firstPos, char *polyLine, char *bedLine, SNPrecord &record, SNPvisitor &visitor, SiteSummary *summary){
+	unsigned int chrPos = firstPos;
+	for (size_t i = 0; i < nSites; i++) {
+		bool polymorphic = false;
+		bool biallelic   = true;    // only biallelic SNPs allowed in BED files
+		const char anc   = refBuf[i]; // the ancestral state
+		char first       = seqBufs[0][i]; // only looking for sites polymorphic within the sample; ones only divergent from reference not counted; therefore, the first genotype is the point of comparison
+		char alt         = '\0';
+		
+		// going over all the population lines
+		for (size_t iLine = 0; iLine < nLines; iLine++) {
+			const char geno = seqBufs[iLine][i];
+			polyLine[iLine] = geno;
+			if (first == 'N') {
+				first = geno; // this will keep happening until we hit a non-missing genotype
+			}
+			if ( (geno != 'N') && (geno != first) ) { // if the first genotype was missing as of previous line, polymorphic definitely not set to true for this line because in that case we just set first to geno (that's why no else clause here!)
+				if (!alt) {
+					alt = geno;
+				} else {
+					if (alt != geno) { // there already is an alternative and it is not the same as the current SNP
+						biallelic = false;
+						break; // if not biallelic, no use continuing with this site
+					}
+				}
+				polymorphic = true;
+			}
+		}
+		if (summary) {
+			summary->first.push_back(first);
+			summary->alt.push_back(biallelic ? alt : '*');
+		}
+		if (polymorphic && biallelic) {  // a biallelic polymorphic site
+			record.position  = chrPos;
+			setAlleles(record, anc, first, alt);
+			packBED(polyLine, nLines, record.alt, bedLine);
+			visitor.snp(record);
+		}
+		chrPos++;
+	}
+}
+
+void SFparse::_biallelicScan(SNPvisitor &visitor, const size_t &resumeOffset, SiteSummary *summary){
+	size_t bufSize = _bufAlloc/(_inFileNames.size() + 1);
+	
+	// a shard only covers its slice of the reference; otherwise the slice is unbounded and we read to the end of the reference
+	size_t sliceBeg = 0;
+	size_t sliceEnd = 0;
+	_slice(sliceBeg, sliceEnd);
+	if (resumeOffset > sliceBeg) {
+		sliceBeg = resumeOffset;
+	}
+	bool notDone = (sliceEnd > sliceBeg);
+	
+	SeqReader inRef(_refFlName);
+	
+	vector<SeqReader*> inSeqs;
+	for (auto flnIt = _inFileNames.begin(); flnIt != _inFileNames.end(); ++flnIt) {
+		inSeqs.push_back( new SeqReader(*flnIt) );
+	}
+	vector<char*> seqBufs(_inFileNames.size());
+	
+	/*
+	 *  There is a limit on how many files can be open at the same time
+	 *  The readers open plain SEQ files anew for each chunk; endPos is the place I save where I am to return to in the next iteration (if any)
+	 */
+	size_t endPosR          = sliceBeg;
+	size_t endPosS          = 0;
+	unsigned int chrPos     = sliceBeg + 1;
+	unsigned int bedLineLen = ceil(static_cast<double>(_lineNames.size())/4.0); // SNPs are packed into bytes, four per byte with padding at each locus
+	
+	char *polyLine = new char[_inFileNames.size()];
+	char *bedLine  = new char[bedLineLen];
+	
+	SNPrecord record;
+	record.genotypes = polyLine;
+	record.nLines    = _inFileNames.size();
+	record.bedRow    = bedLine;
+	record.bedRowLen = bedLineLen;
+	if (summary) {
+		summary->nRuns.assign( _inFileNames.size(), vector<uint32_t>() );
+	}
+	
+	// Read the FASTA files into the buffers, iterate until end of file is reached in the reference (this means that if, contrary to expectation, the sample files are longer they will be truncated)
+	while (notDone) {
+		if (sliceEnd - endPosR < bufSize) { // the slice ends within this chunk
+			bufSize = sliceEnd - endPosR + 1;
+			notDone = false;
+		}
+		char *refBuf = new char[bufSize]; // one extra for the null terminator
+		const size_t nRead = inRef.getLine(endPosR, refBuf, bufSize);
+		inRef.stopOnProblem();
+		if (nRead < bufSize - 1) { // did we read to the end?
+			bufSize = nRead + 1;
+			notDone = false;
+		}
+		endPosS  = endPosR; // save the previous state of endPosR to read the population sample file
+		endPosR += nRead;   // save position
+		
+		for (auto sqbIt = seqBufs.begin(); sqbIt != seqBufs.end(); ++sqbIt) {
+			*sqbIt = new char[bufSize];
+		}
+		readEach(inSeqs, [&inSeqs, &seqBufs, endPosS, bufSize](const size_t &iSeq){
+			inSeqs[iSeq]->getLine(endPosS, seqBufs[iSeq], bufSize);
+		});
+		
+		visitor.sites(refBuf, seqBufs.data(), seqBufs.size(), bufSize - 1, chrPos - 1);
+		// going over each site in the buffer, checking for polymorphism
+		scanSites(refBuf, seqBufs.data(), seqBufs.size(), bufSize - 1, chrPos, polyLine, bedLine, record, visitor, summary);
+		chrPos += bufSize - 1;
+		visitor.chunkDone(chrPos - 1);
+		if (summary) {
+			for (size_t iLine = 0; iLine < seqBufs.size(); iLine++) {
+				addNruns(seqBufs[iLine], bufSize - 1, chrPos - bufSize, summary->nRuns[iLine]);
 			}
-			
-			inRef.get(refBuf, bufSize);
-			if (inRef.gcount() < bufSize - 1) { // did we read to the end?
-				bufSize = inRef.gcount() + 1;
-				notDone = false;
+		}
+		
+		for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); ++sbIt) {
+			delete [] *sbIt;
+		}
+		delete [] refBuf;
+	}
+	
+	delete [] polyLine;
+	delete [] bedLine;
+	for (auto isfIt = inSeqs.begin(); isfIt != inSeqs.end(); ++isfIt) {
+		delete *isfIt;
+	}
+}
+
+bool SFparse::_updateBED(const SiteSummary &oldSum, const string &outBedName, const string &outBimName, const string &outFamName, const string &sumName){
+	// the summary must describe the same reference and a leading subset of the current lines, with the files unchanged
+	const size_t nOld = oldSum.files.size() - 1;
+	const size_t nAll = _inFileNames.size();
+	if ( (oldSum.chromName != _chromName) || (nOld > nAll) || (oldSum.nRuns.size() != nOld) ) {
+		return false;
+	}
+	vector<string> curFiles(1, _refFlName);
+	curFiles.insert(curFiles.end(), _inFileNames.begin(), _inFileNames.end());
+	SiteSummary newSum;
+	newSum.chromName = _chromName;
+	newSum.files     = curFiles;
+	newSum.sizes.resize(curFiles.size());
+	newSum.mtimes.resize(curFiles.size());
+	for (size_t iFl = 0; iFl < curFiles.size(); iFl++) {
+		fileStamp(curFiles[iFl], newSum.sizes[iFl], newSum.mtimes[iFl]);
+		if ( (iFl <= nOld) && ( (curFiles[iFl] != oldSum.files[iFl]) || (newSum.sizes[iFl] != oldSum.sizes[iFl]) || (newSum.mtimes[iFl] != oldSum.mtimes[iFl]) ) ) {
+			return false;
+		}
+	}
+	const size_t nSites      = oldSum.first.size();
+	const size_t oldLineLen  = (nOld + 3)/4;
+	uint64_t nOldSNP         = 0;
+	for (auto altIt = oldSum.alt.begin(); altIt != oldSum.alt.end(); ++altIt) {
+		nOldSNP += ( (*altIt != '\0') && (*altIt != '*') );
+	}
+	if (fileSize(outBedName) != 3 + nOldSNP*oldLineLen) { // the old BED file is missing or does not match the summary
+		return false;
+	}
+	if (nOld == nAll) { // no new lines; the output is up to date
+		return true;
+	}
+	
+	const size_t nNew     = nAll - nOld;
+	size_t chunkLen       = _bufAlloc/(nNew + 1);
+	chunkLen              = (chunkLen < nSites ? chunkLen : nSites); // the buffers below are zero-filled, so anything longer than the chromosome would be committed for nothing
+	chunkLen              = (chunkLen > 1 ? chunkLen : 1);
+	newSum.first.resize(nSites);
+	newSum.alt.resize(nSites);
+	newSum.nRuns = oldSum.nRuns;
+	newSum.nRuns.resize(nAll);
+	
+	ifstream oldBed(outBedName.c_str(), ios::binary);
+	oldBed.seekg(3);
+	const string tmpBedName = outBedName + ".tmp";
+	const string tmpBimName = outBimName + ".tmp";
+	ofstream outBed(tmpBedName.c_str(), ios::binary | ios::trunc);
+	if (!outBed) {
+		cerr << "ERROR: unable to open BED file " << tmpBedName << " for data output in SFparse()" << endl;
+		exit(6);
+	}
+	ofstream outBim(tmpBimName.c_str(), ios::trunc);
+	if (!outBim) {
+		cerr << "ERROR: unable to open .bim file " << tmpBimName << " for data output in SFparse()" << endl;
+		exit(6);
+	}
+	char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+	outBed.write(magicBytes, 3);
+	BEDwriter bedWriter(outBed, outBim, _chromNum, _chromName);
+	
+	vector<char> refBuf(chunkLen);
+	vector< vector<char> > newBufs( nNew, vector<char>(chunkLen) );
+	vector<char> oldRow(oldLineLen);
+	vector<char> polyLine(nAll);
+	vector<char> bedLine((nAll + 3)/4);
+	vector<size_t> runIdx(nOld, 0); // current missing-genotype run for each old line
+	SNPrecord record;
+	record.genotypes = polyLine.data();
+	record.nLines    = nAll;
+	record.bedRow    = bedLine.data();
+	record.bedRowLen = bedLine.size();
+	
+	SeqReader refReader(_refFlName);
+	vector<SeqReader*> newReaders;
+	for (size_t iNew = 0; iNew < nNew; iNew++) {
+		newReaders.push_back( new SeqReader(_inFileNames[nOld + iNew]) );
+	}
+	for (size_t chunkBeg = 0; chunkBeg < nSites; chunkBeg += chunkLen) {
+		const size_t len = (nSites - chunkBeg < chunkLen ? nSites - chunkBeg : chunkLen);
+		readSeqChunk(refReader, chunkBeg, refBuf.data(), len);
+		refReader.stopOnProblem();
+		readEach(newReaders, [&newReaders, &newBufs, chunkBeg, len](const size_t &iNew){
+			readSeqChunk(*newReaders[iNew], chunkBeg, newBufs[iNew].data(), len);
+		});
+		for (size_t iNew = 0; iNew < nNew; iNew++) {
+			addNruns(newBufs[iNew].data(), len, chunkBeg, newSum.nRuns[nOld + iNew]);
+		}
+		
+		for (size_t iChunk = 0; iChunk < len; iChunk++) {
+			const size_t iSite = chunkBeg + iChunk;
+			char first         = oldSum.first[iSite];
+			char alt           = oldSum.alt[iSite];
+			bool biallelic     = (alt != '*');
+			const bool oldSNP  = biallelic && alt;
+			if (oldSNP) {
+				oldBed.read(oldRow.data(), oldLineLen);
 			}
-			endPosS = endPosR;       // save the previous state of endPosR to read the population sample file
-			endPosR = inRef.tellg(); // save position
-			inRef.close();
-			
-			auto isfIt = inSeqs.begin();
-			auto flnIt = _inFileNames.begin();
-			for (auto sqbIt = seqBufs.begin(); sqbIt != seqBufs.end(); ++sqbIt) {
-				isfIt->open(flnIt->c_str());
-				if (!isfIt->is_open()) {
-					cerr << "ERROR: unable to open file " << *flnIt << " in SFparse()" << endl;
-					exit(5);
+			// continue the classification with the new lines, exactly as if they were scanned after the old ones
+			for (size_t iNew = 0; biallelic && (iNew < nNew); iNew++) {
+				const char geno = newBufs[iNew][iChunk];
+				if (first == 'N') {
+					first = geno;
 				}
-				if (endPosS) {
-					isfIt->seekg(endPosS);
+				if ( (geno != 'N') && (geno != first) ) {
+					if (!alt) {
+						alt = geno;
+					} else if (alt != geno) {
+						biallelic = false;
+					}
 				}
-				
-				*sqbIt = new char[bufSize];
-				isfIt->get(*sqbIt, bufSize);
-				isfIt->close();
-				++isfIt;
-				++flnIt;
+			}
+			newSum.first[iSite] = first;
+			newSum.alt[iSite]   = (biallelic ? alt : '*');
+			if ( !(biallelic && alt) ) {
+				continue;
 			}
 			
-			char *polyLine = new char[_inFileNames.size() + 1];
-			for (size_t i = 0; i < (bufSize - 1); i++) {
-				bool polymorphic = false;
-				polyLine[0] = refBuf[i];
-				unsigned int iLine = 1;
-				refBuf[i] = seqBufs[0][i]; // only looking for sites polymorphic within the sample; ones only divergent from reference not counted; therefore, the genotype of the i-th nucleotide for the first line is set to reference
-				for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); sbIt++) {
-					polyLine[iLine] = (*sbIt)[i];
-					iLine++;
-					if (refBuf[i] == 'N') {
-						refBuf[i] = (*sbIt)[i];
-					}
-					if ( ((*sbIt)[i] != 'N') && ((*sbIt)[i] != refBuf[i]) ) { // if reference was missing, polymorphic definitely not set to true for this line
-						polymorphic = true;
+			if (oldSNP) { // old genotypes come from the old BED row
+				SNPrecord oldRec;
+				setAlleles(oldRec, refBuf[iChunk], oldSum.first[iSite], oldSum.alt[iSite]);
+				for (size_t iOld = 0; iOld < nOld; iOld++) {
+					const char code = (oldRow[iOld/4] >> (2*(iOld%4))) & 0x03;
+					polyLine[iOld]  = (code == 0x00 ? oldRec.alt : (code == 0x01 ? 'N' : oldRec.ref));
+				}
+			} else { // the site was monomorphic among the old lines, so each has either the first allele or is missing
+				for (size_t iOld = 0; iOld < nOld; iOld++) {
+					const vector<uint32_t> &runs = oldSum.nRuns[iOld];
+					while ( (runIdx[iOld] < runs.size()) && (runs[runIdx[iOld] + 1] <= iSite) ) {
+						runIdx[iOld] += 2;
 					}
+					const bool missing = (runIdx[iOld] < runs.size()) && (runs[runIdx[iOld]] <= iSite);
+					polyLine[iOld]     = (missing ? 'N' : oldSum.first[iSite]);
 				}
-				if (polymorphic) {
-					outDat.write(reinterpret_cast<char*>(&chrPos), sizeof(unsigned int));
-					outDat.write(polyLine, _inFileNames.size() + 1);
+			}
+			for (size_t iNew = 0; iNew < nNew; iNew++) {
+				polyLine[nOld + iNew] = newBufs[iNew][iChunk];
+			}
+			record.position = iSite + 1;
+			setAlleles(record, refBuf[iChunk], first, alt);
+			packBED(polyLine.data(), nAll, record.alt, bedLine.data());
+			bedWriter.snp(record);
+		}
+	}
+	for (auto rdIt = newReaders.begin(); rdIt != newReaders.end(); ++rdIt) {
+		delete *rdIt;
+	}
+	oldBed.close();
+	outBed.close();
+	outBim.close();
+	
+	if ( (rename(tmpBedName.c_str(), outBedName.c_str()) != 0) || (rename(tmpBimName.c_str(), outBimName.c_str()) != 0) ) {
+		cerr << "ERROR: unable to replace " << outBedName << " with the updated data in SFparse()" << endl;
+		exit(6);
+	}
+	ofstream outFam(outFamName);
+	if (!outFam) {
+		cerr << "ERROR: unable to open .fam file " << outFamName << " for output in SFparse()" << endl;
+		exit(6);
+	}
+	for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
+		outFam << *lnNamIt << " " << *lnNamIt << " 0 0 0 -9" << endl;
+	}
+	outFam.close();
+	saveSummary(sumName, newSum);
+	
+	return true;
+}
+
+void SFparse::_windowedScan(SNPvisitor &visitor, SiteSummary *summary){
+	if (_winSize == 0) {
+		_biallelicScan(visitor, 0, summary);
+		return;
+	}
+	if (_nShards > 1) {
+		cerr << "ERROR: window summaries are not available for sharded runs" << endl;
+		exit(4);
+	}
+	WindowStats winStats(_lineNames, _chromName, _winSize, _winStep);
+	VisitorPair both(visitor, winStats);
+	_biallelicScan(both, 0, summary);
+	winStats.save(_outFileName + ".win");
+}
+
+BEDwriter::BEDwriter(ostream &bedOut, ostream &bimOut, const unsigned short &chrNum, const string &chrName) : _bedOut(&bedOut), _bimOut(&bimOut), _bedRows(nullptr), _bimRows(nullptr), _chromNum(chrNum), _chromName(chrName), _nSNP(0) {
+}
+
+BEDwriter::BEDwriter(vector<char> &bedRows, string &bimRows, const unsigned short &chrNum, const string &chrName) : _bedOut(nullptr), _bimOut(nullptr), _bedRows(&bedRows), _bimRows(&bimRows), _chromNum(chrNum), _chromName(chrName), _nSNP(0) {
+}
+
+/** \brief Format a _.bim_ line
+ *
+ * \param[in] chrNum chromosome number
+ * \param[in] chrName chromosome name
+ * \param[in] rec SNP record
+ *
+ * \return _.bim_ line, with the end of line
+ */
+static string bimLine(const unsigned short &chrNum, const string &chrName, const SNPrecord &rec){
+	// SNP names are "s", position, the tag if any, underscore, chromosome name
+	string line = to_string(chrNum) + " s" + to_string(rec.position);
+	if (rec.tag) {
+		line += rec.tag;
+	}
+	line += "_" + chrName + " -9 " + to_string(rec.position) + " " + rec.alt + " " + rec.ref + "\n";
+	
+	return line;
+}
+
+void BEDwriter::snp(const SNPrecord &rec){
+	const string bimLine = ::bimLine(_chromNum, _chromName, rec);
+	
+	if (_bedRows) {
+		_bedRows->insert(_bedRows->end(), rec.bedRow, rec.bedRow + rec.bedRowLen);
+		*_bimRows += bimLine;
+	} else {
+		_bedOut->write(rec.bedRow, rec.bedRowLen);
+		*_bimOut << bimLine;
+	}
+	_nSNP++;
+}
+
+WindowStats::WindowStats(const vector<string> &lineNames, const string &chrName, const uint32_t &winSize, const uint32_t &step) : _lineNames(lineNames), _chromName(chrName), _winSize(winSize), _step(step) {
+	if ( (_step == 0) || (_winSize < _step) || (_winSize % _step) ) {
+		cerr << "ERROR: window size " << _winSize << " is not a multiple of the step " << _step << " in WindowStats" << endl;
+		exit(4);
+	}
+}
+
+void WindowStats::sites(const char *refBuf, const char * const *seqBufs, const size_t &nLines, const size_t &nSites, const size_t &offset){
+	if (nSites == 0) {
+		return;
+	}
+	const size_t firstBin = offset/_step;
+	const size_t nBins    = (offset + nSites + _step - 1)/_step;
+	if (_binSites.size() < nBins) {
+		_binSites.resize(nBins, 0);
+		_binOutgroup.resize(nBins, 0);
+		_binSNP.resize(nBins, 0);
+		_binMissing.resize(nBins*nLines, 0);
+		_binCalled.resize(nBins*nLines, 0);
+		_binDivergent.resize(nBins*nLines, 0);
+	}
+	for (size_t iBin = firstBin; iBin < nBins; iBin++) {
+		const size_t segBeg = (iBin*_step > offset ? iBin*_step - offset : 0);
+		const size_t segEnd = ( (iBin + 1)*_step - offset < nSites ? (iBin + 1)*_step - offset : nSites );
+		uint32_t nOutgroup  = 0;
+		for (size_t iSite = segBeg; iSite < segEnd; iSite++) {
+			nOutgroup += (refBuf[iSite] != 'N');
+		}
+		_binSites[iBin]    += segEnd - segBeg;
+		_binOutgroup[iBin] += nOutgroup;
+		// each line's counters for the bin are next to each other, and each line's sequence is read in one pass
+		for (size_t iLine = 0; iLine < nLines; iLine++) {
+			const char *seq     = seqBufs[iLine];
+			uint32_t nMissing   = 0;
+			uint32_t nCalled    = 0;
+			uint32_t nDivergent = 0;
+			for (size_t iSite = segBeg; iSite < segEnd; iSite++) {
+				const bool missing = (seq[iSite] == 'N');
+				const bool called  = !missing && (refBuf[iSite] != 'N');
+				nMissing   += missing;
+				nCalled    += called;
+				nDivergent += called && (seq[iSite] != refBuf[iSite]);
+			}
+			_binMissing[iBin*nLines + iLine]   += nMissing;
+			_binCalled[iBin*nLines + iLine]    += nCalled;
+			_binDivergent[iBin*nLines + iLine] += nDivergent;
+		}
+	}
+}
+
+void WindowStats::snp(const SNPrecord &rec){
+	const size_t iBin = (rec.position - 1)/_step;
+	if ( iBin < _binSNP.size() ) {
+		_binSNP[iBin]++;
+	}
+}
+
+void WindowStats::save(const string &outFlNam) const {
+	ofstream winOut(outFlNam.c_str(), ios::trunc);
+	if (!winOut) {
+		cerr << "ERROR: unable to open window summary file " << outFlNam << " for output in WindowStats" << endl;
+		exit(6);
+	}
+	winOut << "chrom\tstart\tend\tsites\toutgroup\tSNPs";
+	for (auto lnIt = _lineNames.begin(); lnIt != _lineNames.end(); ++lnIt) {
+		winOut << "\tmiss_" << *lnIt;
+	}
+	for (auto lnIt = _lineNames.begin(); lnIt != _lineNames.end(); ++lnIt) {
+		winOut << "\tdiv_" << *lnIt;
+	}
+	winOut << "\n";
+	
+	const size_t nLines      = _lineNames.size();
+	const size_t binsPerWin  = _winSize/_step;
+	vector<uint64_t> missing(nLines);
+	vector<uint64_t> called(nLines);
+	vector<uint64_t> divergent(nLines);
+	for (size_t winBin = 0; winBin < _binSites.size(); winBin++) {
+		const size_t endBin = (winBin + binsPerWin < _binSites.size() ? winBin + binsPerWin : _binSites.size());
+		uint64_t nSites     = 0;
+		uint64_t nOutgroup  = 0;
+		uint64_t nSNP       = 0;
+		fill(missing.begin(), missing.end(), 0);
+		fill(called.begin(), called.end(), 0);
+		fill(divergent.begin(), divergent.end(), 0);
+		for (size_t iBin = winBin; iBin < endBin; iBin++) {
+			nSites    += _binSites[iBin];
+			nOutgroup += _binOutgroup[iBin];
+			nSNP      += _binSNP[iBin];
+			for (size_t iLine = 0; iLine < nLines; iLine++) {
+				missing[iLine]   += _binMissing[iBin*nLines + iLine];
+				called[iLine]    += _binCalled[iBin*nLines + iLine];
+				divergent[iLine] += _binDivergent[iBin*nLines + iLine];
+			}
+		}
+		winOut << _chromName << "\t" << winBin*_step + 1 << "\t" << winBin*_step + nSites << "\t" << nSites << "\t" << nOutgroup << "\t" << nSNP;
+		for (size_t iLine = 0; iLine < nLines; iLine++) {
+			winOut << "\t" << static_cast<double>(missing[iLine])/static_cast<double>(nSites);
+		}
+		for (size_t iLine = 0; iLine < nLines; iLine++) {
+			if (called[iLine]) {
+				winOut << "\t" << static_cast<double>(divergent[iLine])/static_cast<double>(called[iLine]);
+			} else {
+				winOut << "\tNA";
+			}
+		}
+		winOut << "\n";
+	}
+	winOut.close();
+	if (!winOut) {
+		cerr << "ERROR: failed to save window summary file " << outFlNam << " in WindowStats" << endl;
+		exit(6);
+	}
+}
+
+BEDdedup::BEDdedup(ostream &patternOut, ostream &bimOut, const unsigned short &chrNum, const string &chrName, const uint32_t &window) : _patternOut(&patternOut), _bimOut(&bimOut), _chromNum(chrNum), _chromName(chrName), _window(window), _nPatterns(0), _rowLength(0) {
+}
+
+void BEDdedup::snp(const SNPrecord &rec){
+	const uint64_t iSNP = _patternIDs.size();
+	_rowLength          = rec.bedRowLen;
+	// FNV-1a hash of the row
+	uint64_t rowHash = 14695981039346656037ULL;
+	for (size_t iByte = 0; iByte < rec.bedRowLen; iByte++) {
+		rowHash ^= static_cast<unsigned char>(rec.bedRow[iByte]);
+		rowHash *= 1099511628211ULL;
+	}
+	auto rowIt = _recent.find(rowHash);
+	if ( (rowIt != _recent.end()) && (iSNP - rowIt->second.lastSNP <= _window) && (rowIt->second.row.compare(0, string::npos, rec.bedRow, rec.bedRowLen) == 0) ) {
+		rowIt->second.lastSNP = iSNP;
+		_patternIDs.push_back(rowIt->second.patternID);
+	} else { // a new pattern; a hash collision replaces the older row
+		RecentRow &recent = _recent[rowHash];
+		recent.row        = string(rec.bedRow, rec.bedRowLen);
+		recent.patternID  = _nPatterns;
+		recent.lastSNP    = iSNP;
+		_patternIDs.push_back(_nPatterns);
+		_patternOut->write(rec.bedRow, rec.bedRowLen);
+		_nPatterns++;
+	}
+	*_bimOut << bimLine(_chromNum, _chromName, rec);
+	
+	// rows not seen for a window are dropped every window, so the table holds at most two windows of rows
+	if ( (iSNP + 1) % _window == 0 ) {
+		for (auto recIt = _recent.begin(); recIt != _recent.end(); ) {
+			if (iSNP - recIt->second.lastSNP >= _window) {
+				recIt = _recent.erase(recIt);
+			} else {
+				++recIt;
+			}
+		}
+	}
+}
+
+void BEDdedup::savePatternIndex(const string &pidFlNam) const {
+	ofstream pidOut(pidFlNam.c_str(), ios::binary | ios::trunc);
+	if (!pidOut) {
+		cerr << "ERROR: unable to open pattern index file " << pidFlNam << " for output in BEDdedup" << endl;
+		exit(6);
+	}
+	const uint32_t version   = 1;
+	const uint64_t nSNP      = _patternIDs.size();
+	const uint64_t nPatterns = _nPatterns;
+	pidOut.write("A2BP", 4);
+	pidOut.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	pidOut.write(reinterpret_cast<const char*>(&nSNP), sizeof(uint64_t));
+	pidOut.write(reinterpret_cast<const char*>(&nPatterns), sizeof(uint64_t));
+	pidOut.write(reinterpret_cast<const char*>(&_rowLength), sizeof(uint64_t));
+	pidOut.write(reinterpret_cast<const char*>(&_window), sizeof(uint32_t));
+	pidOut.write(reinterpret_cast<const char*>(_patternIDs.data()), nSNP*sizeof(uint32_t));
+	pidOut.close();
+	if (!pidOut) {
+		cerr << "ERROR: failed to save pattern index file " << pidFlNam << " in BEDdedup" << endl;
+		exit(6);
+	}
+}
+
+BEDpatterns::BEDpatterns(const string &dbedFlNam, const string &pidFlNam) : _rowLength(0) {
+	ifstream pidIn(pidFlNam.c_str(), ios::binary);
+	if (!pidIn) {
+		cerr << "ERROR: unable to open pattern index file " << pidFlNam << " in BEDpatterns()" << endl;
+		exit(1);
+	}
+	char tag[4];
+	uint32_t version   = 0;
+	uint64_t nSNP      = 0;
+	uint64_t nPatterns = 0;
+	uint32_t window    = 0;
+	pidIn.read(tag, 4);
+	pidIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	pidIn.read(reinterpret_cast<char*>(&nSNP), sizeof(uint64_t));
+	pidIn.read(reinterpret_cast<char*>(&nPatterns), sizeof(uint64_t));
+	pidIn.read(reinterpret_cast<char*>(&_rowLength), sizeof(uint64_t));
+	pidIn.read(reinterpret_cast<char*>(&window), sizeof(uint32_t));
+	if ( !pidIn || (string(tag, 4) != "A2BP") || (version != 1) ) {
+		cerr << "ERROR: " << pidFlNam << " is not a valid pattern index file" << endl;
+		exit(7);
+	}
+	_patternIDs.resize(nSNP);
+	pidIn.read(reinterpret_cast<char*>(_patternIDs.data()), nSNP*sizeof(uint32_t));
+	if (!pidIn) {
+		cerr << "ERROR: pattern index file " << pidFlNam << " is truncated" << endl;
+		exit(7);
+	}
+	pidIn.close();
+	
+	if (fileSize(dbedFlNam) != 3 + nPatterns*_rowLength) {
+		cerr << "ERROR: size of " << dbedFlNam << " does not match the pattern index " << pidFlNam << endl;
+		exit(7);
+	}
+	ifstream dbedIn(dbedFlNam.c_str(), ios::binary);
+	dbedIn.seekg(3); // skip the BED magic bytes
+	_patterns.resize(nPatterns*_rowLength);
+	dbedIn.read(_patterns.data(), _patterns.size());
+	if (!dbedIn) {
+		cerr << "ERROR: unable to read patterns from " << dbedFlNam << " in BEDpatterns()" << endl;
+		exit(5);
+	}
+	for (auto pidIt = _patternIDs.begin(); pidIt != _patternIDs.end(); ++pidIt) {
+		if (*pidIt >= nPatterns) {
+			cerr << "ERROR: pattern ID " << *pidIt << " out of range in " << pidFlNam << endl;
+			exit(7);
+		}
+	}
+}
+
+void BEDpatterns::expand(const string &outFlNam) const {
+	ofstream outBed(outFlNam.c_str(), ios::binary | ios::trunc);
+	if (!outBed) {
+		cerr << "ERROR: unable to open BED file " << outFlNam << " for output in BEDpatterns" << endl;
+		exit(6);
+	}
+	char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+	outBed.write(magicBytes, 3);
+	for (auto pidIt = _patternIDs.begin(); pidIt != _patternIDs.end(); ++pidIt) {
+		outBed.write(pattern(*pidIt), _rowLength);
+	}
+	outBed.close();
+	if (!outBed) {
+		cerr << "ERROR: failed to save BED file " << outFlNam << " in BEDpatterns" << endl;
+		exit(6);
+	}
+}
+
+/** \brief Append an unsigned integer
+ *
+ * Writes the decimal digits of _value_ at _dest_ and moves _dest_ past them.
+ *
+ * \param[in,out] dest output position
+ * \param[in] value integer to format
+ */
+static void appendUInt(char *&dest, uint64_t value){
+	char digits[20];
+	int nDigits = 0;
+	do {
+		digits[nDigits++] = '0' + static_cast<char>(value % 10);
+		value /= 10;
+	} while (value);
+	while (nDigits) {
+		*dest++ = digits[--nDigits];
+	}
+}
+
+/** \brief Append a string
+ *
+ * Copies _str_ to _dest_ and moves _dest_ past it.
+ *
+ * \param[in,out] dest output position
+ * \param[in] str string to copy
+ */
+static void appendString(char *&dest, const string &str){
+	memcpy(dest, str.data(), str.size());
+	dest += str.size();
+}
+
+/// Largest BGZF block input; leaves room for the header and footer even if the data do not compress
+static const size_t bgzfBlockInput = 0xff00;
+
+#ifdef USE_ZLIB
+/** \brief Compress a BGZF block
+ *
+ * Saves the data as one BGZF block: a gzip member with the block size in the "BC" extra field.
+ *
+ * \param[in] data data to compress
+ * \param[in] len data length, no more than _bgzfBlockInput_
+ * \param[out] block compressed block
+ */
+static void bgzfBlock(const char *data, const size_t &len, vector<char> &block){
+	const size_t headLen = 18;
+	const size_t footLen = 8;
+	block.resize(65536);
+	size_t cLen = 0;
+	for (int level = Z_DEFAULT_COMPRESSION; ; level = Z_NO_COMPRESSION) { // if the data do not compress enough, store them
+		z_stream strm;
+		strm.zalloc = Z_NULL;
+		strm.zfree  = Z_NULL;
+		strm.opaque = Z_NULL;
+		if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			cerr << "ERROR: unable to initialize BGZF compression in VCFwriter" << endl;
+			exit(6);
+		}
+		strm.next_in   = reinterpret_cast<Bytef*>( const_cast<char*>(data) );
+		strm.avail_in  = len;
+		strm.next_out  = reinterpret_cast<Bytef*>(block.data() + headLen);
+		strm.avail_out = block.size() - headLen - footLen;
+		const int status = deflate(&strm, Z_FINISH);
+		cLen = strm.total_out;
+		deflateEnd(&strm);
+		if (status == Z_STREAM_END) {
+			break;
+		}
+		if (level == Z_NO_COMPRESSION) {
+			cerr << "ERROR: BGZF block does not fit after compression in VCFwriter" << endl;
+			exit(6);
+		}
+	}
+	const size_t blockSize = headLen + cLen + footLen;
+	const unsigned char header[] = {0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 'B', 'C', 0x02, 0, static_cast<unsigned char>( (blockSize - 1) & 0xff ), static_cast<unsigned char>( (blockSize - 1) >> 8 )};
+	memcpy(block.data(), header, headLen);
+	const uint32_t crc   = crc32( crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), len );
+	const uint32_t iSize = len;
+	unsigned char *footer = reinterpret_cast<unsigned char*>(block.data() + headLen + cLen);
+	for (int iByte = 0; iByte < 4; iByte++) { // little-endian regardless of the platform
+		footer[iByte]     = (crc >> (8*iByte)) & 0xff;
+		footer[iByte + 4] = (iSize >> (8*iByte)) & 0xff;
+	}
+	block.resize(blockSize);
+}
+#endif
+
+VCFwriter::VCFwriter(ostream &vcfOut, const vector<string> &lineNames, const string &chrName, const unsigned int &nThreads) : _vcfOut(&vcfOut), _chromName(chrName), _buffer(16*bgzfBlockInput*(nThreads > 16 ? nThreads : 16)), _fill(0), _nThreads(nThreads), _nSNP(0) {
+#ifndef USE_ZLIB
+	if (_nThreads) {
+		cerr << "ERROR: BGZF compression requires compiling with USE_ZLIB" << endl;
+		exit(4);
+	}
+#endif
+	// everything that is not the alternative allele or missing is the reference, as in the BED files
+	for (int iNuc = 0; iNuc < 256; iNuc++) {
+		memcpy(_genoTable[iNuc], "\t0/0", 4);
+	}
+	memcpy(_genoTable[static_cast<unsigned char>('N')], "\t./.", 4);
+	
+	string header = "##fileformat=VCFv4.2\n##source=align2bed\n##contig=<ID=" + _chromName + ">\n";
+	header += "##INFO=<ID=AA,Number=1,Type=String,Description=\"Ancestral allele\">\n";
+	header += "##INFO=<ID=TAG,Number=1,Type=String,Description=\"m if the ancestral allele is missing, d if it is different from both alleles\">\n";
+	header += "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n";
+	header += "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+	for (auto lnIt = lineNames.begin(); lnIt != lineNames.end(); ++lnIt) {
+		header += "\t" + *lnIt;
+	}
+	header += "\n";
+	_reserve( header.size() );
+	char *dest = _buffer.data() + _fill;
+	appendString(dest, header);
+	_fill = dest - _buffer.data();
+}
+
+void VCFwriter::_reserve(const size_t &nBytes){
+	if (_buffer.size() - _fill < nBytes) {
+		_flush();
+		if (_buffer.size() < nBytes) {
+			_buffer.resize(nBytes);
+		}
+	}
+}
+
+void VCFwriter::_flush(){
+	if (_nThreads == 0) {
+		_vcfOut->write(_buffer.data(), _fill);
+		_fill = 0;
+		return;
+	}
+#ifdef USE_ZLIB
+	// thread i compresses blocks i, i + nThreads, ...; the blocks are then saved in order
+	const size_t nBlocks = (_fill + bgzfBlockInput - 1)/bgzfBlockInput;
+	vector< vector<char> > blocks(nBlocks);
+	vector<thread> compressors;
+	for (unsigned int iThr = 0; (iThr < _nThreads) && (iThr < nBlocks); iThr++) {
+		compressors.push_back(thread([this, &blocks, nBlocks, iThr](){
+			for (size_t iBlk = iThr; iBlk < nBlocks; iBlk += _nThreads) {
+				const size_t blkBeg = iBlk*bgzfBlockInput;
+				const size_t blkLen = (_fill - blkBeg < bgzfBlockInput ? _fill - blkBeg : bgzfBlockInput);
+				bgzfBlock(_buffer.data() + blkBeg, blkLen, blocks[iBlk]);
+			}
+		}));
+	}
+	for (auto thrIt = compressors.begin(); thrIt != compressors.end(); ++thrIt) {
+		thrIt->join();
+	}
+	for (auto blkIt = blocks.begin(); blkIt != blocks.end(); ++blkIt) {
+		_vcfOut->write(blkIt->data(), blkIt->size());
+	}
+	_fill = 0;
+#endif
+}
+
+void VCFwriter::snp(const SNPrecord &rec){
+	// CHROM, POS, ID, REF, ALT, QUAL, FILTER, INFO and FORMAT take at most this much, not counting the chromosome name twice
+	_reserve(2*_chromName.size() + 96 + 4*rec.nLines);
+	char *dest = _buffer.data() + _fill;
+	
+	appendString(dest, _chromName);
+	*dest++ = '\t';
+	appendUInt(dest, rec.position);
+	*dest++ = '\t';
+	*dest++ = 's'; // the same SNP name as in the .bim file
+	appendUInt(dest, rec.position);
+	if (rec.tag) {
+		*dest++ = rec.tag;
+	}
+	*dest++ = '_';
+	appendString(dest, _chromName);
+	*dest++ = '\t';
+	*dest++ = rec.ref;
+	*dest++ = '\t';
+	*dest++ = rec.alt;
+	memcpy(dest, "\t.\t.\t", 5);
+	dest += 5;
+	if (rec.ancestral != 'N') {
+		memcpy(dest, "AA=", 3);
+		dest += 3;
+		*dest++ = rec.ancestral;
+		if (rec.tag) {
+			*dest++ = ';';
+		}
+	}
+	if (rec.tag) {
+		memcpy(dest, "TAG=", 4);
+		dest += 4;
+		*dest++ = rec.tag;
+	}
+	memcpy(dest, "\tGT", 3);
+	dest += 3;
+	
+	const unsigned char altIdx = static_cast<unsigned char>(rec.alt);
+	memcpy(_genoTable[altIdx], "\t1/1", 4);
+	for (size_t iLine = 0; iLine < rec.nLines; iLine++) {
+		memcpy(dest, _genoTable[static_cast<unsigned char>(rec.genotypes[iLine])], 4);
+		dest += 4;
+	}
+	memcpy(_genoTable[altIdx], (rec.alt == 'N' ? "\t./." : "\t0/0"), 4);
+	*dest++ = '\n';
+	
+	_fill = dest - _buffer.data();
+	_nSNP++;
+}
+
+void VCFwriter::finish(){
+	if (_fill) {
+		_flush();
+	}
+#ifdef USE_ZLIB
+	if (_nThreads) {
+		const unsigned char eofBlock[] = {0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 'B', 'C', 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0}; // empty block that marks the end of a BGZF file
+		_vcfOut->write(reinterpret_cast<const char*>(eofBlock), sizeof(eofBlock));
+	}
+#endif
+	_vcfOut->flush();
+}
+
+BEDindex::BEDindex(const string &indexFlNam) : _nLines(0), _bedLineLen(0) {
+	ifstream idxIn(indexFlNam.c_str(), ios::binary);
+	if (!idxIn) {
+		cerr << "ERROR: cannot open index file " << indexFlNam << " in BEDindex constructor" << endl;
+		exit(1);
+	}
+	char tag[4];
+	uint32_t version = 0;
+	idxIn.read(tag, 4);
+	idxIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	if ( !idxIn || (string(tag, 4) != "A2BI") || (version != 1) ) {
+		cerr << "ERROR: file " << indexFlNam << " is not a valid position index in BEDindex constructor" << endl;
+		exit(7);
+	}
+	uint64_t nSNP    = 0;
+	uint32_t nChrom  = 0;
+	idxIn.read(reinterpret_cast<char*>(&nSNP), sizeof(uint64_t));
+	idxIn.read(reinterpret_cast<char*>(&_nLines), sizeof(uint64_t));
+	idxIn.read(reinterpret_cast<char*>(&nChrom), sizeof(uint32_t));
+	_bedLineLen = (_nLines + 3)/4;
+	
+	for (uint32_t iChr = 0; iChr < nChrom; iChr++) {
+		uint32_t nameLen = 0;
+		uint64_t first   = 0;
+		uint64_t count   = 0;
+		idxIn.read(reinterpret_cast<char*>(&nameLen), sizeof(uint32_t));
+		string name(nameLen, ' ');
+		idxIn.read(&name[0], nameLen);
+		idxIn.read(reinterpret_cast<char*>(&first), sizeof(uint64_t));
+		idxIn.read(reinterpret_cast<char*>(&count), sizeof(uint64_t));
+		_chrNames.push_back(name);
+		_chrFirst.push_back(first);
+		_chrCount.push_back(count);
+	}
+	_positions.resize(nSNP);
+	_bimOffsets.resize(nSNP + 1);
+	idxIn.read(reinterpret_cast<char*>(_positions.data()), nSNP*sizeof(uint32_t));
+	idxIn.read(reinterpret_cast<char*>(_bimOffsets.data()), (nSNP + 1)*sizeof(uint64_t));
+	if (!idxIn) {
+		cerr << "ERROR: index file " << indexFlNam << " is truncated in BEDindex constructor" << endl;
+		exit(7);
+	}
+	idxIn.close();
+}
+
+BEDindex::BEDindex(const string &bimFlNam, const string &famFlNam) : _nLines(0), _bedLineLen(0) {
+	ifstream famIn(famFlNam.c_str());
+	if (!famIn) {
+		cerr << "ERROR: cannot open .fam file " << famFlNam << " in BEDindex constructor" << endl;
+		exit(1);
+	}
+	string eachLine;
+	while (getline(famIn, eachLine)) {
+		if (!eachLine.empty()) {
+			_nLines++;
+		}
+	}
+	famIn.close();
+	_bedLineLen = (_nLines + 3)/4; // four genotypes per byte, padded at each locus
+	
+	ifstream bimIn(bimFlNam.c_str(), ios::binary);
+	if (!bimIn) {
+		cerr << "ERROR: cannot open .bim file " << bimFlNam << " in BEDindex constructor" << endl;
+		exit(1);
+	}
+	uint64_t offset = 0;
+	while (getline(bimIn, eachLine)) {
+		_bimOffsets.push_back(offset);
+		offset += eachLine.size() + 1;
+		
+		// split out the first four whitespace-delimited fields: chromosome, SNP name, genetic and physical positions
+		string fields[4];
+		size_t fldEnd = 0;
+		for (unsigned short iFld = 0; iFld < 4; iFld++) {
+			size_t fldBeg = eachLine.find_first_not_of(" \t", fldEnd);
+			if (fldBeg == string::npos) {
+				cerr << "ERROR: too few fields in line " << _bimOffsets.size() << " of .bim file " << bimFlNam << " in BEDindex constructor" << endl;
+				exit(7);
+			}
+			fldEnd = eachLine.find_first_of(" \t", fldBeg);
+			fields[iFld] = eachLine.substr(fldBeg, fldEnd - fldBeg);
+		}
+		size_t undPos = fields[1].rfind('_');
+		const string chrom = (undPos == string::npos ? fields[0] : fields[1].substr(undPos + 1));
+		const uint32_t pos = static_cast<uint32_t>( strtoul(fields[3].c_str(), nullptr, 10) );
+		
+		if ( _chrNames.empty() || (_chrNames.back() != chrom) ) {
+			for (auto chrIt = _chrNames.begin(); chrIt != _chrNames.end(); ++chrIt) {
+				if (*chrIt == chrom) {
+					cerr << "ERROR: rows of chromosome " << chrom << " are not contiguous in .bim file " << bimFlNam << "; cannot index" << endl;
+					exit(7);
 				}
-				chrPos++;
 			}
-			
-			delete [] polyLine;
-			
-			for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); ++sbIt) {
-				delete [] *sbIt;
+			_chrNames.push_back(chrom);
+			_chrFirst.push_back(_positions.size());
+			_chrCount.push_back(0);
+		} else if (pos < _positions.back()) {
+			cerr << "ERROR: positions on chromosome " << chrom << " are not sorted in .bim file " << bimFlNam << "; cannot index" << endl;
+			exit(7);
+		}
+		_positions.push_back(pos);
+		_chrCount.back()++;
+	}
+	bimIn.clear();
+	bimIn.seekg(0, ios::end);
+	const uint64_t bimSize = bimIn.tellg();
+	_bimOffsets.push_back(offset > bimSize ? bimSize : offset); // in case the last line has no end-of-line character
+	bimIn.close();
+}
+
+void BEDindex::save(const string &outFlNam) const {
+	ofstream idxOut(outFlNam.c_str(), ios::binary | ios::trunc);
+	if (!idxOut) {
+		cerr << "ERROR: unable to open index file " << outFlNam << " for output in BEDindex::save()" << endl;
+		exit(6);
+	}
+	const uint32_t version = 1;
+	const uint64_t nSNP    = _positions.size();
+	const uint32_t nChrom  = _chrNames.size();
+	idxOut.write("A2BI", 4);
+	idxOut.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+	idxOut.write(reinterpret_cast<const char*>(&nSNP), sizeof(uint64_t));
+	idxOut.write(reinterpret_cast<const char*>(&_nLines), sizeof(uint64_t));
+	idxOut.write(reinterpret_cast<const char*>(&nChrom), sizeof(uint32_t));
+	for (uint32_t iChr = 0; iChr < nChrom; iChr++) {
+		const uint32_t nameLen = _chrNames[iChr].size();
+		idxOut.write(reinterpret_cast<const char*>(&nameLen), sizeof(uint32_t));
+		idxOut.write(_chrNames[iChr].c_str(), nameLen);
+		idxOut.write(reinterpret_cast<const char*>(&_chrFirst[iChr]), sizeof(uint64_t));
+		idxOut.write(reinterpret_cast<const char*>(&_chrCount[iChr]), sizeof(uint64_t));
+	}
+	idxOut.write(reinterpret_cast<const char*>(_positions.data()), nSNP*sizeof(uint32_t));
+	idxOut.write(reinterpret_cast<const char*>(_bimOffsets.data()), _bimOffsets.size()*sizeof(uint64_t));
+	idxOut.close();
+}
+
+BEDrange BEDindex::query(const string &chrom, const uint32_t &start, const uint32_t &end) const {
+	BEDrange range = {0, 0, 3, 3, 0, 0};
+	for (size_t iChr = 0; iChr < _chrNames.size(); iChr++) {
+		if (_chrNames[iChr] == chrom) {
+			auto chrBeg = _positions.begin() + _chrFirst[iChr];
+			auto chrEnd = chrBeg + _chrCount[iChr];
+			auto lowIt  = lower_bound(chrBeg, chrEnd, start);
+			auto highIt = upper_bound(lowIt, chrEnd, end);
+			
+			range.firstRow = lowIt - _positions.begin();
+			range.nRows    = (start > end ? 0 : highIt - lowIt);
+			range.bedBegin = 3 + range.firstRow*_bedLineLen; // skipping the magic bytes
+			range.bedEnd   = range.bedBegin + range.nRows*_bedLineLen;
+			range.bimBegin = _bimOffsets[range.firstRow];
+			range.bimEnd   = _bimOffsets[range.firstRow + range.nRows];
+			break;
+		}
+	}
+	
+	return range;
+}
+
+/** \brief Shard fragment metadata
+ *
+ * Header of a BED fragment saved by a sharded SFparse run.
+ */
+struct ShardInfo {
+	/// Fragment base name (no extension)
+	string baseName;
+	/// Number of SNPs
+	uint64_t nSNP;
+	/// Shard index
+	uint32_t shard;
+	/// Number of shards
+	uint32_t nShards;
+	/// First position in the shard
+	uint64_t firstPos;
+	/// One past the last position in the shard
+	uint64_t endPos;
+	/// Number of lines
+	uint64_t nLines;
+	/// Chromosome number
+	unsigned short chrNum;
+	/// Chromosome name
+	string chrName;
+	/// Header length in bytes
+	uint64_t headerLen;
+};
+
+/** \brief Append a file to an output stream
+ *
+ * Copies everything from the current position of the input stream to the end.
+ *
+ * \param[in] in input stream
+ * \param[in] out output stream
+ *
+ * \return number of end-of-line characters copied
+ */
+static uint64_t appendBytes(ifstream &in, ofstream &out){
+	const size_t chunkSize = 4194304; // 4 Mb
+	vector<char> chunk(chunkSize);
+	uint64_t nEOL = 0;
+	while (in) {
+		in.read(chunk.data(), chunkSize);
+		const streamsize nRead = in.gcount();
+		for (streamsize iCh = 0; iCh < nRead; iCh++) {
+			nEOL += (chunk[iCh] == '\n');
+		}
+		out.write(chunk.data(), nRead);
+	}
+	
+	return nEOL;
+}
+
+void mergeShards(const vector<string> &fragNames, const string &outFlNam){
+	if (fragNames.empty()) {
+		cerr << "ERROR: no fragments to merge in mergeShards()" << endl;
+		exit(8);
+	}
+	vector<ShardInfo> fragments;
+	for (auto frgIt = fragNames.begin(); frgIt != fragNames.end(); ++frgIt) {
+		ShardInfo info;
+		info.baseName = *frgIt;
+		if ( (info.baseName.size() > 4) && (info.baseName.compare(info.baseName.size() - 4, 4, ".bed") == 0) ) {
+			info.baseName.erase(info.baseName.size() - 4);
+		}
+		const string bedName = info.baseName + ".bed";
+		ifstream frgIn(bedName.c_str(), ios::binary);
+		if (!frgIn) {
+			cerr << "ERROR: cannot open BED fragment " << bedName << " in mergeShards()" << endl;
+			exit(1);
+		}
+		char tag[4];
+		uint32_t version = 0;
+		uint32_t nameLen = 0;
+		frgIn.read(tag, 4);
+		frgIn.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+		frgIn.read(reinterpret_cast<char*>(&info.nSNP), sizeof(uint64_t));
+		frgIn.read(reinterpret_cast<char*>(&info.shard), sizeof(uint32_t));
+		frgIn.read(reinterpret_cast<char*>(&info.nShards), sizeof(uint32_t));
+		frgIn.read(reinterpret_cast<char*>(&info.firstPos), sizeof(uint64_t));
+		frgIn.read(reinterpret_cast<char*>(&info.endPos), sizeof(uint64_t));
+		frgIn.read(reinterpret_cast<char*>(&info.nLines), sizeof(uint64_t));
+		frgIn.read(reinterpret_cast<char*>(&info.chrNum), sizeof(unsigned short));
+		frgIn.read(reinterpret_cast<char*>(&nameLen), sizeof(uint32_t));
+		if ( !frgIn || (string(tag, 4) != "A2BF") || (version != 1) || (nameLen > 1024) ) {
+			cerr << "ERROR: file " << bedName << " is not a valid BED fragment in mergeShards()" << endl;
+			exit(8);
+		}
+		info.chrName.resize(nameLen);
+		frgIn.read(&info.chrName[0], nameLen);
+		info.headerLen = frgIn.tellg();
+		frgIn.seekg(0, ios::end);
+		const uint64_t frgSize = frgIn.tellg();
+		frgIn.close();
+		if (frgSize != info.headerLen + info.nSNP*((info.nLines + 3)/4)) {
+			cerr << "ERROR: BED fragment " << bedName << " is truncated or unfinished in mergeShards()" << endl;
+			exit(8);
+		}
+		if ( !fragments.empty() && (info.nLines != fragments[0].nLines) ) {
+			cerr << "ERROR: BED fragment " << bedName << " has " << info.nLines << " lines instead of " << fragments[0].nLines << " in mergeShards()" << endl;
+			exit(8);
+		}
+		fragments.push_back(info);
+	}
+	
+	// chromosomes are kept in the order of first appearance, fragments within chromosomes are sorted by shard
+	vector<string> chromOrder;
+	for (auto frgIt = fragments.begin(); frgIt != fragments.end(); ++frgIt) {
+		bool seen = false;
+		for (auto chrIt = chromOrder.begin(); chrIt != chromOrder.end(); ++chrIt) {
+			if (*chrIt == frgIt->chrName) {
+				seen = true;
+				break;
+			}
+		}
+		if (!seen) {
+			chromOrder.push_back(frgIt->chrName);
+		}
+	}
+	vector<ShardInfo> sorted;
+	for (auto chrIt = chromOrder.begin(); chrIt != chromOrder.end(); ++chrIt) {
+		vector<ShardInfo> chrFrags;
+		for (auto frgIt = fragments.begin(); frgIt != fragments.end(); ++frgIt) {
+			if (frgIt->chrName == *chrIt) {
+				chrFrags.push_back(*frgIt);
 			}
-			delete [] refBuf;
 		}
-		
-		outDat.close();
-		
-	} else if ( (_inFileType == "SEQ") && (_outFileType == "BED") ) {
-		size_t bufSize = _bufAlloc/(_inFileNames.size() + 1);
-		bool notDone = true;
-		
-		string outBedName = _outFileName + ".bed";
-		string outBimName = _outFileName + ".bim";
-		string outFamName = _outFileName + ".fam";
-		
-		// first save the .fam file
-		ofstream outFam(outFamName);
-		if (!outFam) {
-			cerr << "ERROR: unable to open .fam file " << outFamName << " for output in SFparse()" << endl;
-			exit(6);
+		sort(chrFrags.begin(), chrFrags.end(), [](const ShardInfo &a, const ShardInfo &b){return a.shard < b.shard; });
+		if (chrFrags.size() != chrFrags[0].nShards) {
+			cerr << "ERROR: " << chrFrags.size() << " fragments of chromosome " << *chrIt << " found, expected " << chrFrags[0].nShards << " in mergeShards()" << endl;
+			exit(8);
 		}
-		for (auto lnNamIt = _lineNames.begin(); lnNamIt != _lineNames.end(); ++lnNamIt) {
-			outFam << *lnNamIt << " " << *lnNamIt << " 0 0 0 -9" << endl;
+		uint64_t expectedPos = 1;
+		for (uint32_t iFrg = 0; iFrg < chrFrags.size(); iFrg++) {
+			if ( (chrFrags[iFrg].shard != iFrg) || (chrFrags[iFrg].nShards != chrFrags[0].nShards) ) {
+				cerr << "ERROR: fragment " << chrFrags[iFrg].baseName << " does not fit the shard series of chromosome " << *chrIt << " in mergeShards()" << endl;
+				exit(8);
+			}
+			if (chrFrags[iFrg].firstPos != expectedPos) {
+				cerr << "ERROR: fragment " << chrFrags[iFrg].baseName << " starts at position " << chrFrags[iFrg].firstPos << " instead of " << expectedPos << " in mergeShards()" << endl;
+				exit(8);
+			}
+			expectedPos = chrFrags[iFrg].endPos;
+			sorted.push_back(chrFrags[iFrg]);
 		}
-		outFam.close();
-		
-		ifstream inRef;
-		
-		vector<ifstream> inSeqs(_inFileNames.size());
-		vector<char*> seqBufs(_inFileNames.size());
-		
-		remove(outBedName.c_str());
-		ofstream outBed(outBedName, ios::binary);
-		if (!outBed) {
-			cerr << "ERROR: unable to open BED file " << outBedName << " for data output in SFparse()" << endl;
-			exit(6);
+	}
+	
+	string outBase = outFlNam;
+	if ( (outBase.size() > 4) && (outBase.compare(outBase.size() - 4, 4, ".bed") == 0) ) {
+		outBase.erase(outBase.size() - 4);
+	}
+	const string outBedName = outBase + ".bed";
+	const string outBimName = outBase + ".bim";
+	const string outFamName = outBase + ".fam";
+	
+	// all fragments must share the .fam file
+	string famText;
+	for (auto frgIt = sorted.begin(); frgIt != sorted.end(); ++frgIt) {
+		const string famName = frgIt->baseName + ".fam";
+		ifstream famIn(famName.c_str(), ios::binary);
+		if (!famIn) {
+			cerr << "ERROR: cannot open .fam fragment " << famName << " in mergeShards()" << endl;
+			exit(1);
+		}
+		string curFam( (istreambuf_iterator<char>(famIn)), istreambuf_iterator<char>() );
+		famIn.close();
+		if (frgIt == sorted.begin()) {
+			famText = curFam;
+		} else if (curFam != famText) {
+			cerr << "ERROR: .fam fragment " << famName << " does not match the others in mergeShards()" << endl;
+			exit(8);
 		}
+	}
+	ofstream outFam(outFamName.c_str(), ios::binary | ios::trunc);
+	if (!outFam) {
+		cerr << "ERROR: unable to open .fam file " << outFamName << " for output in mergeShards()" << endl;
+		exit(6);
+	}
+	outFam << famText;
+	outFam.close();
+	
+	ofstream outBed(outBedName.c_str(), ios::binary | ios::trunc);
+	if (!outBed) {
+		cerr << "ERROR: unable to open BED file " << outBedName << " for output in mergeShards()" << endl;
+		exit(6);
+	}
+	ofstream outBim(outBimName.c_str(), ios::binary | ios::trunc);
+	if (!outBim) {
+		cerr << "ERROR: unable to open .bim file " << outBimName << " for output in mergeShards()" << endl;
+		exit(6);
+	}
+	char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+	outBed.write(magicBytes, 3);
+	
+	for (auto frgIt = sorted.begin(); frgIt != sorted.end(); ++frgIt) {
+		ifstream frgBed( (frgIt->baseName + ".bed").c_str(), ios::binary );
+		frgBed.seekg(frgIt->headerLen);
+		appendBytes(frgBed, outBed);
+		frgBed.close();
 		
-		remove(outBimName.c_str());
-		ofstream outBim(outBimName);
-		if (!outBim) {
-			cerr << "ERROR: unable to open .bim file " << outBimName << " for data output in SFparse()" << endl;
+		const string bimName = frgIt->baseName + ".bim";
+		ifstream frgBim(bimName.c_str(), ios::binary);
+		if (!frgBim) {
+			cerr << "ERROR: cannot open .bim fragment " << bimName << " in mergeShards()" << endl;
+			exit(1);
+		}
+		const uint64_t nBimLines = appendBytes(frgBim, outBim);
+		frgBim.close();
+		if (nBimLines != frgIt->nSNP) {
+			cerr << "ERROR: .bim fragment " << bimName << " has " << nBimLines << " lines, but the BED fragment has " << frgIt->nSNP << " SNPs in mergeShards()" << endl;
+			exit(8);
+		}
+	}
+	outBed.close();
+	outBim.close();
+}
+
+/** \brief Write a buffer at a file offset
+ *
+ * Repeats _pwrite()_ until the whole buffer is saved.
+ *
+ * \param[in] fd file descriptor
+ * \param[in] buf buffer to save
+ * \param[in] nBytes number of bytes to save
+ * \param[in] offset file offset
+ */
+static void pwriteAll(const int &fd, const char *buf, size_t nBytes, off_t offset){
+	while (nBytes) {
+		const ssize_t nWritten = pwrite(fd, buf, nBytes, offset);
+		if (nWritten <= 0) {
+			cerr << "ERROR: failed to write BED rows at offset " << offset << " in saveGenomeBED()" << endl;
 			exit(6);
 		}
-		char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
-		outBed.write(magicBytes, 3);
-		
-		/*
-		 *  There is a limit on how many files can be open at the same time
-		 *  I have to close the SEQ files after reading each chunk; endPos is the place I save where I am to return to in the next iteration (if any)
-		 */
-		size_t endPosR          = 0;
-		size_t endPosS          = 0;
-		unsigned int chrPos     = 1;
-		unsigned int bedLineLen = ceil(static_cast<double>(_lineNames.size())/4.0); // SNPs are packed into bytes, four per byte with padding at each locus
-		
-		// Read the FASTA files into the buffers, iterate until end of file is reached in the reference (this means that if, contrary to expectation, the sample files are longer they will be truncated)
-		while (notDone) {
-			char *refBuf = new char[bufSize]; // one extra for the null terminator
-			inRef.open(_refFlName.c_str());
-			if (!inRef) {
-				cerr << "ERROR: unable to open reference file " << _refFlName << " in SFparse()" << endl;
-				exit(5);
-				
-			}
-			
-			if (endPosR) {
-				inRef.seekg(endPosR);
+		buf    += nWritten;
+		nBytes -= nWritten;
+		offset += nWritten;
+	}
+}
+
+void saveGenomeBED(vector<SFparse> &parsers, const string &outFlNam){
+	if (parsers.empty()) {
+		cerr << "ERROR: nothing to save in saveGenomeBED()" << endl;
+		exit(4);
+	}
+	for (auto prsIt = parsers.begin(); prsIt != parsers.end(); ++prsIt) {
+		if (!prsIt->_genomeWide) {
+			cerr << "ERROR: chromosome " << prsIt->_chromName << " was not run with genome-wide output in saveGenomeBED()" << endl;
+			exit(4);
+		}
+		if (prsIt->_lineNames != parsers[0]._lineNames) {
+			cerr << "ERROR: lines of chromosome " << prsIt->_chromName << " do not match those of " << parsers[0]._chromName << " in saveGenomeBED()" << endl;
+			exit(4);
+		}
+	}
+	const uint64_t bedLineLen = (parsers[0]._lineNames.size() + 3)/4;
+	
+	// exclusive prefix sum of SNP counts gives the first row of each chromosome
+	vector<uint64_t> rowOffsets(parsers.size(), 0);
+	uint64_t nRows = 0;
+	for (size_t iPrs = 0; iPrs < parsers.size(); iPrs++) {
+		rowOffsets[iPrs] = nRows;
+		nRows           += parsers[iPrs]._nSNP;
+	}
+	
+	string outBase = outFlNam;
+	if ( (outBase.size() > 4) && (outBase.compare(outBase.size() - 4, 4, ".bed") == 0) ) {
+		outBase.erase(outBase.size() - 4);
+	}
+	const string outBedName = outBase + ".bed";
+	const string outBimName = outBase + ".bim";
+	const string outFamName = outBase + ".fam";
+	
+	ofstream outFam(outFamName);
+	if (!outFam) {
+		cerr << "ERROR: unable to open .fam file " << outFamName << " for output in saveGenomeBED()" << endl;
+		exit(6);
+	}
+	for (auto lnNamIt = parsers[0]._lineNames.begin(); lnNamIt != parsers[0]._lineNames.end(); ++lnNamIt) {
+		outFam << *lnNamIt << " " << *lnNamIt << " 0 0 0 -9" << endl;
+	}
+	outFam.close();
+	
+	const int bedFD = open(outBedName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (bedFD == -1) {
+		cerr << "ERROR: unable to open BED file " << outBedName << " for data output in saveGenomeBED()" << endl;
+		exit(6);
+	}
+	const off_t bedSize = 3 + nRows*bedLineLen;
+	if (ftruncate(bedFD, bedSize) != 0) {
+		cerr << "ERROR: unable to allocate " << bedSize << " bytes for BED file " << outBedName << " in saveGenomeBED()" << endl;
+		exit(6);
+	}
+#ifdef __linux__
+	posix_fallocate(bedFD, 0, bedSize); // reserve the blocks up front where supported; the file is already the right size otherwise
+#endif
+	char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+	pwriteAll(bedFD, magicBytes, 3, 0);
+	
+	vector<thread> writers;
+	for (size_t iPrs = 0; iPrs < parsers.size(); iPrs++) {
+		writers.push_back(thread([&parsers, &rowOffsets, bedFD, bedLineLen, iPrs](){
+			pwriteAll(bedFD, parsers[iPrs]._bedRows.data(), parsers[iPrs]._bedRows.size(), 3 + rowOffsets[iPrs]*bedLineLen);
+			vector<char>().swap(parsers[iPrs]._bedRows);
+		}));
+	}
+	for (auto wrtIt = writers.begin(); wrtIt != writers.end(); ++wrtIt) {
+		wrtIt->join();
+	}
+	close(bedFD);
+	
+	ofstream outBim(outBimName, ios::binary | ios::trunc);
+	if (!outBim) {
+		cerr << "ERROR: unable to open .bim file " << outBimName << " for data output in saveGenomeBED()" << endl;
+		exit(6);
+	}
+	for (auto prsIt = parsers.begin(); prsIt != parsers.end(); ++prsIt) {
+		outBim << prsIt->_bimRows;
+		string().swap(prsIt->_bimRows);
+	}
+	outBim.close();
+}
+
+#ifdef __linux__
+/** \brief Parse a CPU list
+ *
+ * Parses a list of CPU ranges as in sysfs files, e.g. "0-3,8-11".
+ *
+ * \param[in] cpuList CPU list
+ *
+ * \return CPU numbers
+ */
+static vector<int> parseCPUlist(const string &cpuList){
+	vector<int> cpus;
+	size_t pos = 0;
+	while (pos < cpuList.size()) {
+		size_t commaPos = cpuList.find(',', pos);
+		if (commaPos == string::npos) {
+			commaPos = cpuList.size();
+		}
+		const string range = cpuList.substr(pos, commaPos - pos);
+		const size_t dashPos = range.find('-');
+		if ( !range.empty() && isdigit(range[0]) ) {
+			const int first = atoi(range.c_str());
+			const int last  = (dashPos == string::npos ? first : atoi(range.c_str() + dashPos + 1));
+			for (int cpu = first; cpu <= last; cpu++) {
+				cpus.push_back(cpu);
 			}
-			
-			inRef.get(refBuf, bufSize);
-			if (inRef.gcount() < bufSize - 1) { // did we read to the end?
-				bufSize = inRef.gcount() + 1;
-				notDone = false;
+		}
+		pos = commaPos + 1;
+	}
+	
+	return cpus;
+}
+#endif
+
+NUMAlayout::NUMAlayout(){
+#ifdef __linux__
+	// CPUs we are allowed to run on; nodes are restricted to these
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu, &allowed);
+		}
+	}
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if ( CPU_ISSET(cpu, &allowed) ) {
+			_startCPUs.push_back(cpu);
+		}
+	}
+	vector<int> nodeIDs;
+	vector< vector<int> > nodeCPUs;
+#ifdef USE_LIBNUMA
+	if (numa_available() != -1) {
+		struct bitmask *cpuMask = numa_allocate_cpumask();
+		for (int node = 0; node <= numa_max_node(); node++) {
+			if (numa_node_to_cpus(node, cpuMask) != 0) {
+				continue;
 			}
-			endPosS = endPosR;       // save the previous state of endPosR to read the population sample file
-			endPosR = inRef.tellg(); // save position
-			inRef.close();
-			
-			auto isfIt = inSeqs.begin();
-			auto flnIt = _inFileNames.begin();
-			for (auto sqbIt = seqBufs.begin(); sqbIt != seqBufs.end(); ++sqbIt) {
-				isfIt->open(flnIt->c_str());
-				if (!isfIt->is_open()) {
-					cerr << "ERROR: unable to open file " << *flnIt << " in SFparse()" << endl;
-					exit(5);
+			vector<int> cpus;
+			for (unsigned int cpu = 0; cpu < cpuMask->size; cpu++) {
+				if ( numa_bitmask_isbitset(cpuMask, cpu) ) {
+					cpus.push_back(cpu);
 				}
-				if (endPosS) {
-					isfIt->seekg(endPosS);
-				}
-				
-				*sqbIt = new char[bufSize];
-				isfIt->get(*sqbIt, bufSize);
-				isfIt->close();
-				++isfIt;
-				++flnIt;
 			}
-			
-			char *polyLine = new char[_inFileNames.size()];
-			char *bedLine  = new char[bedLineLen];
-			
-			// Pre-form bit masks for going from a char array of genotypes to the packed BED format; the positions go in the reverse direction
-			unordered_map<char, string> bitMasks;
-			bitMasks['A'] = {static_cast<char>(0xFC), static_cast<char>(0xF3), static_cast<char>(0xCF), static_cast<char>(0x3F)}; // alternative (1/1 in plink)
-			// no need for reference (2/2 in plink) because it will be all ones; doing it this way because SFS is heavy on low-frequency derived alleles and so I will mostly not have to do anything with bitmasks
-			bitMasks['H'] = {static_cast<char>(0xFE), static_cast<char>(0xFB), static_cast<char>(0xEF), static_cast<char>(0xBF)}; // heterozygous; we actually do not have any so this is just for future development
-			bitMasks['M'] = {static_cast<char>(0xFD), static_cast<char>(0xF7), static_cast<char>(0xDF), static_cast<char>(0x7F)}; // missing
-			bitMasks['P'] = {static_cast<char>(0x3F), static_cast<char>(0x0F), static_cast<char>(0x03)};                          // padding
-			
-			// going over each site in the buffer, checking for polymorphism
-			for (size_t i = 0; i < (bufSize - 1); i++) {
-				bool polymorphic = false;
-				bool biallelic   = true;    // only biallelic SNPs allowed in BED files
-				char anc = refBuf[i];       // save the ancestral state
-				char alt = '\0';
-				unsigned int iLine = 0;
-				refBuf[i] = seqBufs[0][i];  // only looking for sites polymorphic within the sample; ones only divergent from reference not counted; therefore, the genotype of the i-th nucleotide for the first line is set to reference
-				
-				// going over all the population lines
-				for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); sbIt++) {
-					polyLine[iLine] = (*sbIt)[i];
-					iLine++;
-					if (refBuf[i] == 'N') {
-						refBuf[i] = (*sbIt)[i]; // this will keep happening until we hit a non-missing genotype
-					}
-					if ( ((*sbIt)[i] != 'N') && ((*sbIt)[i] != refBuf[i]) ) { // if reference was missing as of previous line, polymorphic definitely not set to true for this line because in that case we just set refBuf[i] to (*sbIt)[i] (that's why no else clause here!)
-						if (!alt) {
-							alt = (*sbIt)[i];
-						} else {
-							if (alt != (*sbIt)[i]) { // there already is an alternative and it is not the same as the current SNP
-								biallelic = false;
-								break; // if not biallelic, no use continuing with this site
-							}
-						}
-						polymorphic = true;
-					}
+			nodeIDs.push_back(node);
+			nodeCPUs.push_back(cpus);
+		}
+		numa_free_cpumask(cpuMask);
+	}
+#endif
+	if ( nodeIDs.empty() ) {
+		DIR *nodeDir = opendir("/sys/devices/system/node");
+		if (nodeDir != nullptr) {
+			struct dirent *entry;
+			while ( (entry = readdir(nodeDir)) != nullptr ) {
+				const string name(entry->d_name);
+				if ( (name.size() < 5) || (name.compare(0, 4, "node") != 0) || !isdigit(name[4]) ) {
+					continue;
 				}
-				if (polymorphic && biallelic) {  // save a biallelic polymorphic site
-					
-					// first save the .bim metadata
-					if (anc == 'N') { // label the SNP name with 'm' at the end is the ancestral state is missing
-						outBim << _chromNum << " s" << chrPos << "m_" << _chromName << " -9 " << chrPos << " " << alt << " " << refBuf[i] << endl;
-					} else if ( (alt != anc) && (refBuf[i] != anc) ) { // the SNP is biallelic in the sample, but the ancestral state is different from both
-						outBim << _chromNum << " s" << chrPos << "d_" << _chromName << " -9 " << chrPos << " " << alt << " " << refBuf[i] << endl;
-					} else {
-						alt = (alt == anc ? refBuf[i] : alt); // assign ref to alt if alt is ancestral
-						outBim << _chromNum << " s" << chrPos << "_" << _chromName << " -9 " << chrPos << " " << alt << " " << anc << endl;
-					}
-					
-					unsigned int remainPad = bedLineLen * 4; // tracks how many genotypes are left in the padded line
-					size_t iGeno = 0;                        // tracks the number of genotypes processed in the char array formed above (it is unpadded)
-					for (size_t iBed = 0; iBed < bedLineLen; iBed++) {
-						bedLine[iBed] = 0xFF;
-						
-						for (unsigned short bytePos = 0; bytePos < 4; bytePos++) { // actually going from the end of the byte, but that is already accounted for in the bitMaps object
-							if (polyLine[iGeno] == alt) { // alternative (derived)
-								bedLine[iBed] = bedLine[iBed] & bitMasks['A'][bytePos];
-							} else if (polyLine[iGeno] == 'N') { // missing
-								bedLine[iBed] = bedLine[iBed] & bitMasks['M'][bytePos];
-							} // otherwise, it is reference and we do not do anything; no heterozygotes
-							iGeno++;
-							remainPad--;
-							if (iGeno == _lineNames.size()) {
-								if (remainPad != 0) {
-									bedLine[iBed] = bedLine[iBed] & bitMasks['P'][remainPad - 1];
-								}
-								break; // that should automatically get us to the end of the outer loop, too
-							}
-							
-						}
-						
-						
-						
-					}
-					outBed.write(bedLine, bedLineLen);
+				ifstream cpuListIn( ("/sys/devices/system/node/" + name + "/cpulist").c_str() );
+				string cpuList;
+				if ( !getline(cpuListIn, cpuList) ) {
+					continue;
 				}
-				chrPos++;
+				nodeIDs.push_back( atoi(name.c_str() + 4) );
+				nodeCPUs.push_back( parseCPUlist(cpuList) );
 			}
-			
-			delete [] polyLine;
-			delete [] bedLine;
-			
-			for (auto sbIt = seqBufs.begin(); sbIt != seqBufs.end(); ++sbIt) {
-				delete [] *sbIt;
+			closedir(nodeDir);
+		}
+	}
+	
+	// order the nodes by ID and keep the ones with CPUs we can use
+	vector<size_t> order(nodeIDs.size());
+	for (size_t iNode = 0; iNode < order.size(); iNode++) {
+		order[iNode] = iNode;
+	}
+	sort(order.begin(), order.end(), [&nodeIDs](const size_t &left, const size_t &right){return nodeIDs[left] < nodeIDs[right]; });
+	for (auto ordIt = order.begin(); ordIt != order.end(); ++ordIt) {
+		vector<int> cpus;
+		for (auto cpuIt = nodeCPUs[*ordIt].begin(); cpuIt != nodeCPUs[*ordIt].end(); ++cpuIt) {
+			if ( (*cpuIt < CPU_SETSIZE) && CPU_ISSET(*cpuIt, &allowed) ) {
+				cpus.push_back(*cpuIt);
 			}
-			delete [] refBuf;
 		}
+		if ( !cpus.empty() ) {
+			_nodeIDs.push_back(nodeIDs[*ordIt]);
+			_nodeCPUs.push_back(cpus);
+		}
+	}
+#else
+	const unsigned int nCores = thread::hardware_concurrency();
+	for (unsigned int cpu = 0; cpu < (nCores ? nCores : 1); cpu++) {
+		_startCPUs.push_back(cpu);
+	}
+#endif
+	if ( _nodeCPUs.empty() ) { // no NUMA information; one node with every CPU available
+		_nodeIDs.push_back(0);
+		_nodeCPUs.push_back(_startCPUs);
+	}
+}
+
+/** \brief Restrict the calling thread to CPUs
+ *
+ * \param[in] cpus CPU numbers
+ *
+ * \return _true_ if successful; always _false_ where thread affinity is not available
+ */
+static bool setAffinity(const vector<int> &cpus){
+#ifdef __linux__
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	for (auto cpuIt = cpus.begin(); cpuIt != cpus.end(); ++cpuIt) {
+		CPU_SET(*cpuIt, &cpuSet);
+	}
+	return sched_setaffinity(0, sizeof(cpu_set_t), &cpuSet) == 0; // thread ID 0 is the calling thread
+#else
+	return false;
+#endif
+}
+
+bool NUMAlayout::pin(const size_t &iNode) const {
+	if ( (iNode >= _nodeCPUs.size()) || !setAffinity(_nodeCPUs[iNode]) ) {
+		return false;
+	}
+#ifdef USE_LIBNUMA
+	if (numa_available() != -1) {
+		numa_set_localalloc();
+	}
+#endif
+	
+	return true;
+}
+
+bool NUMAlayout::unpin() const {
+	return setAffinity(_startCPUs);
+}
+
+/** \brief Send a buffer
+ *
+ * \param[in] fd socket file descriptor
+ * \param[in] buf data
+ * \param[in] nBytes number of bytes to send
+ *
+ * \return _true_ if all bytes were sent
+ */
+static bool sendAll(const int &fd, const char *buf, size_t nBytes){
+	while (nBytes) {
+		const ssize_t nSent = write(fd, buf, nBytes);
+		if (nSent <= 0) {
+			return false;
+		}
+		buf    += nSent;
+		nBytes -= nSent;
+	}
+	
+	return true;
+}
+
+/** \brief Socket address
+ *
+ * \param[in] socketPath socket file name
+ * \param[out] addr socket address
+ */
+static void socketAddress(const string &socketPath, struct sockaddr_un &addr){
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if ( socketPath.size() >= sizeof(addr.sun_path) ) {
+		cerr << "ERROR: socket path " << socketPath << " is too long" << endl;
+		exit(1);
+	}
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+}
+
+SNPserver::SNPserver(const vector<SFparse> &parsers){
+	for (auto prsIt = parsers.begin(); prsIt != parsers.end(); ++prsIt) {
+		size_t refSize      = 0;
+		const char *refSeq  = _map(prsIt->_refFlName, refSize);
+		const char *lineEnd = static_cast<const char*>( memchr(refSeq, '\n', refSize) );
+		const size_t seqLen = (lineEnd == nullptr ? refSize : lineEnd - refSeq); // as in a BED conversion, the sequence stops at the first end of line
 		
-		outBed.close();
-		outBim.close();
-		
-		
+		vector<const char*> lineSeqs;
+		for (auto flnIt = prsIt->_inFileNames.begin(); flnIt != prsIt->_inFileNames.end(); ++flnIt) {
+			size_t lineSize = 0;
+			lineSeqs.push_back( _map(*flnIt, lineSize) );
+			if (lineSize < seqLen) {
+				cerr << "ERROR: sequence in " << *flnIt << " is shorter than the reference " << prsIt->_refFlName << " in SNPserver()" << endl;
+				exit(5);
+			}
+		}
+		if ( lineSeqs.empty() ) {
+			cerr << "ERROR: no lines for chromosome " << prsIt->_chromName << " in SNPserver()" << endl;
+			exit(5);
+		}
+		_chromNames.push_back(prsIt->_chromName);
+		_chromNums.push_back(prsIt->_chromNum);
+		_lineNames.push_back(prsIt->_lineNames);
+		_refSeqs.push_back(refSeq);
+		_lineSeqs.push_back(lineSeqs);
+		_seqLengths.push_back(seqLen);
+	}
+}
+
+SNPserver::~SNPserver(){
+	for (auto mapIt = _maps.begin(); mapIt != _maps.end(); ++mapIt) {
+		munmap(mapIt->first, mapIt->second);
+	}
+}
+
+const char* SNPserver::_map(const string &flName, size_t &flSize){
+	SeqReader reader(flName);
+	if ( reader.compressed() ) { // compressed files are decompressed into anonymous memory
+		string inflated;
+		vector<char> buf(4194304);
+		size_t nRead = 0;
+		while ( (nRead = reader.read(inflated.size(), buf.data(), buf.size())) > 0 ) {
+			inflated.append(buf.data(), nRead);
+		}
+		reader.stopOnProblem();
+		if ( inflated.empty() ) {
+			cerr << "ERROR: file " << flName << " is empty in SNPserver()" << endl;
+			exit(5);
+		}
+		flSize = inflated.size();
+		void *seq = mmap(nullptr, flSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (seq == MAP_FAILED) {
+			cerr << "ERROR: unable to allocate memory for file " << flName << " in SNPserver()" << endl;
+			exit(5);
+		}
+		memcpy(seq, inflated.data(), flSize);
+		mprotect(seq, flSize, PROT_READ);
+		_maps.push_back( pair<void*, size_t>(seq, flSize) );
 		
+		return static_cast<const char*>(seq);
+	}
+	const int fd = open(flName.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cerr << "ERROR: unable to open file " << flName << " in SNPserver()" << endl;
+		exit(5);
+	}
+	struct stat flStat;
+	if ( (fstat(fd, &flStat) != 0) || (flStat.st_size == 0) ) {
+		cerr << "ERROR: file " << flName << " is empty or cannot be read in SNPserver()" << endl;
+		exit(5);
+	}
+	flSize = flStat.st_size;
+	int mapFlags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	mapFlags |= MAP_POPULATE; // read the file in now rather than at the first request
+#endif
+	void *seq = mmap(nullptr, flSize, PROT_READ, mapFlags, fd, 0);
+	close(fd);
+	if (seq == MAP_FAILED) {
+		cerr << "ERROR: unable to map file " << flName << " in SNPserver()" << endl;
+		exit(5);
+	}
+	madvise(seq, flSize, MADV_WILLNEED);
+	_maps.push_back( pair<void*, size_t>(seq, flSize) );
+	
+	return static_cast<const char*>(seq);
+}
+
+bool SNPserver::_answer(const string &request, string &reply) const {
+	istringstream reqIn(request);
+	string command;
+	reqIn >> command;
+	if (command == "shutdown") {
+		reply = "OK 0 0 0 0\n";
+		return false;
+	}
+	string chrom;
+	string lineList;
+	unsigned long start = 0;
+	unsigned long end   = 0;
+	if ( (command != "region") || !(reqIn >> chrom >> start >> end) || (start == 0) || (end < start) ) {
+		reply = "ERROR malformed request: " + request + "\n";
+		return true;
+	}
+	reqIn >> lineList;
+	
+	const size_t iChr = find(_chromNames.begin(), _chromNames.end(), chrom) - _chromNames.begin();
+	if ( iChr == _chromNames.size() ) {
+		reply = "ERROR unknown chromosome " + chrom + "\n";
+		return true;
+	}
+	const vector<string> &lineNames = _lineNames[iChr];
+	vector<size_t> lineIdx;
+	if ( lineList.empty() ) {
+		for (size_t iLine = 0; iLine < lineNames.size(); iLine++) {
+			lineIdx.push_back(iLine);
+		}
 	} else {
-		cerr << "ERROR: unknown input or output format for parsing" << endl;
-		exit(4);
+		size_t pos = 0;
+		while (pos <= lineList.size()) {
+			size_t commaPos = lineList.find(',', pos);
+			if (commaPos == string::npos) {
+				commaPos = lineList.size();
+			}
+			const string name  = lineList.substr(pos, commaPos - pos);
+			const size_t iLine = find(lineNames.begin(), lineNames.end(), name) - lineNames.begin();
+			if ( iLine == lineNames.size() ) {
+				reply = "ERROR unknown line " + name + "\n";
+				return true;
+			}
+			lineIdx.push_back(iLine);
+			pos = commaPos + 1;
+		}
+	}
+	
+	// SNPs are called among the requested lines only
+	const size_t regBeg = start - 1;
+	const size_t regEnd = (end < _seqLengths[iChr] ? end : _seqLengths[iChr]);
+	const size_t nLines = lineIdx.size();
+	vector<char> bedRows;
+	string bimRows;
+	BEDwriter bedWriter(bedRows, bimRows, _chromNums[iChr], chrom);
+	if (regBeg < regEnd) {
+		vector<const char*> seqs;
+		for (auto idxIt = lineIdx.begin(); idxIt != lineIdx.end(); ++idxIt) {
+			seqs.push_back(_lineSeqs[iChr][*idxIt] + regBeg);
+		}
+		vector<char> polyLine(nLines);
+		vector<char> bedLine((nLines + 3)/4);
+		SNPrecord record;
+		record.genotypes = polyLine.data();
+		record.nLines    = nLines;
+		record.bedRow    = bedLine.data();
+		record.bedRowLen = bedLine.size();
+		scanSites(_refSeqs[iChr] + regBeg, seqs.data(), nLines, regEnd - regBeg, regBeg + 1, polyLine.data(), bedLine.data(), record, bedWriter, nullptr);
+	}
+	string famRows;
+	for (auto idxIt = lineIdx.begin(); idxIt != lineIdx.end(); ++idxIt) {
+		famRows += lineNames[*idxIt] + " " + lineNames[*idxIt] + " 0 0 0 -9\n";
 	}
 	
+	const char magicBytes[] = {0x6C, 0x1B, 0x1}; // BED magic numbers go in the beginning of the file
+	reply  = "OK " + to_string( bedWriter.nSNP() ) + " " + to_string(bedRows.size() + 3) + " " + to_string( bimRows.size() ) + " " + to_string( famRows.size() ) + "\n";
+	reply.append(magicBytes, 3);
+	reply.append(bedRows.data(), bedRows.size());
+	reply += bimRows;
+	reply += famRows;
+	
+	return true;
 }
 
+/// Seconds a client has to send its whole request, and to accept each part of the reply, before the server gives up on it
+static const int clientTimeout = 30;
+/// Maximum number of clients served at the same time
+static const size_t maxClients = 64;
+
+void SNPserver::serve(const string &socketPath) const {
+	signal(SIGPIPE, SIG_IGN); // a client that disconnects early must not stop the server
+	struct sockaddr_un addr;
+	socketAddress(socketPath, addr);
+	const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath.c_str());
+	if ( (sock == -1) || (bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(struct sockaddr_un)) != 0) || (listen(sock, 16) != 0) ) {
+		cerr << "ERROR: unable to listen on socket " << socketPath << " in SNPserver" << endl;
+		exit(1);
+	}
+	
+	/*
+	 * Each connection gets its own thread in one of maxClients slots, so a slow client only holds up itself.
+	 * A thread marks its slot done when it finishes, and the slot's thread is joined before the slot is reused.
+	 * All client threads are joined before serve() returns, so they can use the state on this stack; connections accepted before a shutdown are still answered.
+	 */
+	atomic<bool> running(true);
+	mutex connMutex;
+	condition_variable connDone;
+	vector<thread> clients(maxClients);
+	vector<bool> slotDone(maxClients, true);
+	auto answerClient = [this, &running, &connMutex, &connDone, &slotDone](const int conn, const size_t iSlot){
+		// the request is one line, and all of it must arrive before the deadline
+		const steady_clock::time_point deadline = steady_clock::now() + seconds(clientTimeout);
+		string request;
+		char inBuf[4096];
+		bool timedOut = false;
+		while ( (request.find('\n') == string::npos) && (request.size() < 1048576) ) {
+			const long long msLeft = duration_cast<milliseconds>( deadline - steady_clock::now() ).count();
+			struct pollfd connFD;
+			connFD.fd      = conn;
+			connFD.events  = POLLIN;
+			connFD.revents = 0;
+			if ( (msLeft <= 0) || (poll(&connFD, 1, static_cast<int>(msLeft)) <= 0) ) {
+				timedOut = true;
+				break;
+			}
+			const ssize_t nRead = read(conn, inBuf, sizeof(inBuf));
+			if (nRead <= 0) {
+				break;
+			}
+			request.append(inBuf, nRead);
+		}
+		string reply;
+		if ( timedOut && (request.find('\n') == string::npos) ) {
+			reply = "ERROR no request received within " + to_string(clientTimeout) + " seconds\n";
+		} else {
+			request = request.substr( 0, request.find_first_of("\r\n") );
+			if ( !_answer(request, reply) ) {
+				running = false;
+			}
+		}
+		sendAll(conn, reply.data(), reply.size());
+		close(conn);
+		unique_lock<mutex> lock(connMutex);
+		slotDone[iSlot] = true;
+		connDone.notify_all();
+	};
+	
+	const struct timeval timeout = {clientTimeout, 0};
+	while (running) {
+		size_t iSlot = 0;
+		{
+			unique_lock<mutex> lock(connMutex);
+			connDone.wait(lock, [&slotDone](){return find(slotDone.begin(), slotDone.end(), true) != slotDone.end(); });
+			iSlot = find(slotDone.begin(), slotDone.end(), true) - slotDone.begin();
+		}
+		if ( clients[iSlot].joinable() ) { // the previous client of this slot is done, so this returns at once
+			clients[iSlot].join();
+		}
+		struct pollfd listenFD;
+		listenFD.fd      = sock;
+		listenFD.events  = POLLIN;
+		listenFD.revents = 0;
+		if (poll(&listenFD, 1, 200) <= 0) { // wake up regularly to see if a client asked for a shutdown
+			continue;
+		}
+		const int conn = accept(sock, nullptr, nullptr);
+		if (conn == -1) {
+			continue;
+		}
+		setsockopt( conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(struct timeval) );
+		{
+			unique_lock<mutex> lock(connMutex);
+			slotDone[iSlot] = false;
+		}
+		clients[iSlot] = thread(answerClient, conn, iSlot);
+	}
+	for (auto clIt = clients.begin(); clIt != clients.end(); ++clIt) {
+		if ( clIt->joinable() ) {
+			clIt->join();
+		}
+	}
+	close(sock);
+	unlink(socketPath.c_str());
+}
 
+uint64_t requestSNPs(const string &socketPath, const string &request, const string &outBase){
+	struct sockaddr_un addr;
+	socketAddress(socketPath, addr);
+	const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( (sock == -1) || (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(struct sockaddr_un)) != 0) ) {
+		cerr << "ERROR: unable to connect to server socket " << socketPath << " in requestSNPs()" << endl;
+		exit(1);
+	}
+	const string reqLine = request + "\n";
+	if ( !sendAll(sock, reqLine.data(), reqLine.size()) ) {
+		cerr << "ERROR: unable to send request to " << socketPath << " in requestSNPs()" << endl;
+		exit(1);
+	}
+	string reply;
+	char inBuf[65536];
+	ssize_t nRead = 0;
+	while ( (nRead = read(sock, inBuf, sizeof(inBuf))) > 0 ) {
+		reply.append(inBuf, nRead);
+	}
+	close(sock);
+	
+	const size_t headEnd = reply.find('\n');
+	if ( (headEnd == string::npos) || (reply.compare(0, 3, "OK ") != 0) ) {
+		cerr << "ERROR: server replied: " << reply.substr(0, headEnd) << endl;
+		exit(1);
+	}
+	istringstream headIn( reply.substr(3, headEnd - 3) );
+	uint64_t nSNP     = 0;
+	uint64_t bedBytes = 0;
+	uint64_t bimBytes = 0;
+	uint64_t famBytes = 0;
+	headIn >> nSNP >> bedBytes >> bimBytes >> famBytes;
+	if ( !headIn || (reply.size() != headEnd + 1 + bedBytes + bimBytes + famBytes) ) {
+		cerr << "ERROR: incomplete reply from server " << socketPath << " in requestSNPs()" << endl;
+		exit(5);
+	}
+	if ( outBase.empty() ) {
+		return nSNP;
+	}
+	const string outNames[] = {outBase + ".bed", outBase + ".bim", outBase + ".fam"};
+	const uint64_t nBytes[] = {bedBytes, bimBytes, famBytes};
+	size_t pos              = headEnd + 1;
+	for (int iFl = 0; iFl < 3; iFl++) {
+		ofstream out(outNames[iFl].c_str(), ios::binary | ios::trunc);
+		if (!out) {
+			cerr << "ERROR: unable to open file " << outNames[iFl] << " for output in requestSNPs()" << endl;
+			exit(6);
+		}
+		out.write(reply.data() + pos, nBytes[iFl]);
+		out.close();
+		pos += nBytes[iFl];
+	}
+	
+	return nSNP;
+}
@@ -32,16 +32,101 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <utility>
+#include <unordered_map>
 
 using std::vector;
 using std::string;
 using std::move;
+using std::ofstream;
+using std::ostream;
+using std::pair;
+using std::unordered_map;
 
 class SFparse;
+class SNPvisitor;
+class BEDwriter;
+class VCFwriter;
+class BEDdedup;
+class BEDpatterns;
+class WindowStats;
+class SNPserver;
+class BEDindex;
+struct SNPrecord;
+struct BEDrange;
+struct SiteSummary;
+
+/** \brief Biallelic SNP record
+ *
+ * Describes a biallelic SNP found by SFparse. The genotype and BED row arrays are borrowed from SFparse buffers and are only valid for the duration of the SNPvisitor::snp() call; copy them if they are needed later.
+ */
+struct SNPrecord {
+	/// Chromosome position (1-based)
+	unsigned int position;
+	/// Ancestral (outgroup) nucleotide; _N_ if missing
+	char ancestral;
+	/// Alternative allele (first allele in the _.bim_ file)
+	char alt;
+	/** \brief Reference allele (second allele in the _.bim_ file)
+	 *
+	 * This is the ancestral allele, unless the ancestral state is missing or different from both alleles. In that case it is the first allele seen in the sample.
+	 */
+	char ref;
+	/** \brief SNP name tag
+	 *
+	 * _m_ if the ancestral state is missing, _d_ if it is different from both alleles, and _\\0_ otherwise.
+	 */
+	char tag;
+	/// Genotypes (one nucleotide per line, not null-terminated)
+	const char *genotypes;
+	/// Number of lines
+	size_t nLines;
+	/// Packed genotypes in the _plink_ BED format
+	const char *bedRow;
+	/// Number of bytes in the BED row
+	size_t bedRowLen;
+};
+
+/** \brief SNP visitor
+ *
+ * Base class for in-memory consumers of SFparse output. Derived classes implement snp(), which is called for each biallelic SNP, in position order, as the input files are scanned.
+ */
+class SNPvisitor {
+public:
+	/// Destructor
+	virtual ~SNPvisitor(){};
+	/** \brief Process a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	virtual void snp(const SNPrecord &rec) = 0;
+	/** \brief Chunk finished
+	 *
+	 * Called after all SNPs in a chunk of the input files have been passed to snp(). Does nothing unless overridden.
+	 *
+	 * \param[in] nextOffset zero-based offset of the first site of the next chunk
+	 */
+	virtual void chunkDone(const size_t &/*nextOffset*/) {}
+	/** \brief Chunk sequences
+	 *
+	 * Called with the sequences of each chunk of the input files before its SNPs are passed to snp(). The buffers are only valid during the call. Does nothing unless overridden.
+	 *
+	 * \param[in] refBuf reference (ancestral) sequence
+	 * \param[in] seqBufs sequences of the lines
+	 * \param[in] nLines number of lines
+	 * \param[in] nSites number of sites in the chunk
+	 * \param[in] offset zero-based position of the first site
+	 */
+	virtual void sites(const char * /*refBuf*/, const char * const * /*seqBufs*/, const size_t &/*nLines*/, const size_t &/*nSites*/, const size_t &/*offset*/) {}
+};
 
 /** \brief Sequence file parsing class
  *
  * Takes a list of files in one format and outputs one or more files in a different format, depending on settings. The data are presumed to come from a single chromosome.
+ * The constructors check _.seq_ input files before any conversion starts (see _preflight()), so that unreadable or malformed files are reported at once rather than in the middle of a run.
  *
  * \note Formats will be added as the need arises.
  *
@@ -82,10 +167,103 @@ private:
 	 * Total memory used for all input sequences. Default setting is 2000000000UL (2 Gb).
 	 */
 	unsigned long _bufAlloc;
+	/** \brief Index the output
+	 *
+	 * If _true_, a position index (_.bpi_ file, see BEDindex) is saved alongside BED output. Default is _false_.
+	 */
+	bool _indexOut;
+	/// Shard index
+	unsigned int _shard;
+	/// Number of shards
+	unsigned int _nShards;
+	/// Keep BED output in memory for a genome-wide file
+	bool _genomeWide;
+	/// Packed BED rows held for genome-wide output
+	vector<char> _bedRows;
+	/// _.bim_ lines held for genome-wide output
+	string _bimRows;
+	/// Number of SNPs held for genome-wide output
+	uint64_t _nSNP;
+	/// Save checkpoints and resume from them
+	bool _checkpoint;
+	/// Update existing BED output with added lines
+	bool _incremental;
+	/// Number of BGZF compression threads for VCF output; 0 for uncompressed VCF
+	unsigned int _bgzfThreads;
+	/// Reference sequence length found by the preflight; 0 if unknown
+	size_t _refLength;
+	/// Window (in SNPs) for duplicate BED row detection; 0 switches deduplication off
+	uint32_t _dedupWindow;
+	/// Summary window size in bases; 0 switches window summaries off
+	uint32_t _winSize;
+	/// Summary window step in bases
+	uint32_t _winStep;
+	
+	/** \brief Write a BED fragment header
+	 *
+	 * The header replaces the BED magic bytes in shard fragments. It consists of the "A2BF" tag, format version (32 bit), number of SNPs (64 bit, filled in at the end of the run), shard index and number of shards (32 bit), first position and one past the last position in the shard (64 bit), number of lines (64 bit), chromosome number (16 bit), chromosome name length (32 bit), and the chromosome name.
+	 *
+	 * \param[in] outBed BED fragment output stream
+	 * \param[in] firstPos first position in the shard
+	 * \param[in] endPos one past the last position in the shard
+	 */
+	void _writeShardHeader(ofstream &outBed, const uint64_t &firstPos, const uint64_t &endPos) const;
+	/** \brief Reference slice to process
+	 *
+	 * Zero-based start and one past the end of the shard, computed from the (uncompressed) reference length found by the preflight. Unsharded slices end at the reference length, or at the maximum value of _size_t_ if the length is unknown.
+	 *
+	 * \param[out] sliceBeg slice start
+	 * \param[out] sliceEnd slice end
+	 */
+	void _slice(size_t &sliceBeg, size_t &sliceEnd) const;
+	/** \brief Hash of the inputs
+	 *
+	 * Hashes the chromosome and shard settings with the names, sizes and modification times of all input files. Used to check that a checkpoint belongs to the current run.
+	 *
+	 * \return 64-bit hash
+	 */
+	uint64_t _inputHash() const;
+	/** \brief Check the input files
+	 *
+	 * Checks the reference and line files in parallel: each must be readable, contain only _A_, _C_, _G_, _T_ and _N_ (with an optional end of line at the very end), and all must have the same sequence length. Every problem found is reported before exiting with an error.
+	 * Files that pass are recorded, with their sizes, modification times and sequence lengths, in a manifest (_.mfst_ file) next to the output. Files unchanged since they were recorded are not scanned again.
+	 */
+	void _preflight();
+	/** \brief Scan for biallelic SNPs
+	 *
+	 * Reads the input files in chunks and passes each biallelic SNP to the visitor.
+	 *
+	 * \param[in,out] visitor SNP visitor
+	 * \param[in] resumeOffset zero-based offset to start from, if past the beginning of the slice
+	 * \param[out] summary if not _nullptr_, the site summary is filled in for an unsharded scan from the beginning
+	 */
+	void _biallelicScan(SNPvisitor &visitor, const size_t &resumeOffset = 0, SiteSummary *summary = nullptr);
+	/** \brief Scan with window summaries
+	 *
+	 * Runs _biallelicScan() and, if window summaries are switched on, collects them with a WindowStats visitor in the same pass and saves them to a _.win_ file.
+	 *
+	 * \param[in,out] visitor SNP visitor
+	 * \param[in] summary if not _nullptr_, the site summary is filled in
+	 */
+	void _windowedScan(SNPvisitor &visitor, SiteSummary *summary = nullptr);
+	/** \brief Update BED output with added lines
+	 *
+	 * Re-encodes the existing BED output for the current list of lines, which must start with the lines in the site summary. Genotypes of the old lines are taken from the old BED rows and the summary, so only the reference and the added lines are read.
+	 * The new files are written next to the old ones and then renamed, so an interrupted update leaves the old output intact.
+	 *
+	 * \param[in] oldSum site summary of the existing output
+	 * \param[in] outBedName BED file name
+	 * \param[in] outBimName _.bim_ file name
+	 * \param[in] outFamName _.fam_ file name
+	 * \param[in] sumName site summary file name
+	 *
+	 * \return _false_ if the output cannot be updated and has to be re-created
+	 */
+	bool _updateBED(const SiteSummary &oldSum, const string &outBedName, const string &outBimName, const string &outFamName, const string &sumName);
 	
 public:
 	/// Default constructor
-	SFparse() : _bufAlloc(2000000000UL){};
+	SFparse() : _bufAlloc(2000000000UL), _indexOut(false), _shard(0), _nShards(1), _genomeWide(false), _nSNP(0), _checkpoint(false), _incremental(false), _bgzfThreads(0), _refLength(0), _dedupWindow(0), _winSize(0), _winStep(0){};
 	/** \brief Constructor with vectors of names
 	 *
 	 * Takes vectors of input and output file names. Note that the number of lines cannot be bigger than maximum of _unsigned int_. This is not checked. Also, the _lineNames_ vector must have one fewer elements than the _inFlNam_ vector.
@@ -135,7 +313,7 @@ public:
 	 *
 	 * \param[in] inObj object to be copied
 	 */
-	SFparse(const SFparse &inObj) : _inFileNames(inObj._inFileNames), _lineNames(inObj._lineNames), _refFlName(inObj._refFlName), _outFileName(inObj._outFileName), _inFileType(inObj._inFileType), _outFileType(inObj._outFileType), _chromName(inObj._chromName), _chromNum(inObj._chromNum), _bufAlloc(inObj._bufAlloc) {};
+	SFparse(const SFparse &inObj) : _inFileNames(inObj._inFileNames), _lineNames(inObj._lineNames), _refFlName(inObj._refFlName), _outFileName(inObj._outFileName), _inFileType(inObj._inFileType), _outFileType(inObj._outFileType), _chromName(inObj._chromName), _chromNum(inObj._chromNum), _bufAlloc(inObj._bufAlloc), _indexOut(inObj._indexOut), _shard(inObj._shard), _nShards(inObj._nShards), _genomeWide(inObj._genomeWide), _bedRows(inObj._bedRows), _bimRows(inObj._bimRows), _nSNP(inObj._nSNP), _checkpoint(inObj._checkpoint), _incremental(inObj._incremental), _bgzfThreads(inObj._bgzfThreads), _refLength(inObj._refLength), _dedupWindow(inObj._dedupWindow), _winSize(inObj._winSize), _winStep(inObj._winStep) {};
 	/** \brief Copy assignement operator
 	 *
 	 * \param[in] inObj object to be copied
@@ -147,7 +325,7 @@ public:
 	 *
 	 * \param[in] inObj object to be moved
 	 */
-	SFparse(SFparse &&inObj) : _inFileNames(move(inObj._inFileNames)), _lineNames(move(inObj._lineNames)), _refFlName(move(inObj._refFlName)), _outFileName(move(inObj._outFileName)), _inFileType(move(inObj._inFileType)), _outFileType(move(inObj._outFileType)), _chromName(move(inObj._chromName)), _chromNum(move(inObj._chromNum)), _bufAlloc(move(inObj._bufAlloc)) {};
+	SFparse(SFparse &&inObj) : _inFileNames(move(inObj._inFileNames)), _lineNames(move(inObj._lineNames)), _refFlName(move(inObj._refFlName)), _outFileName(move(inObj._outFileName)), _inFileType(move(inObj._inFileType)), _outFileType(move(inObj._outFileType)), _chromName(move(inObj._chromName)), _chromNum(move(inObj._chromNum)), _bufAlloc(move(inObj._bufAlloc)), _indexOut(move(inObj._indexOut)), _shard(move(inObj._shard)), _nShards(move(inObj._nShards)), _genomeWide(move(inObj._genomeWide)), _bedRows(move(inObj._bedRows)), _bimRows(move(inObj._bimRows)), _nSNP(move(inObj._nSNP)), _checkpoint(move(inObj._checkpoint)), _incremental(move(inObj._incremental)), _bgzfThreads(move(inObj._bgzfThreads)), _refLength(move(inObj._refLength)), _dedupWindow(move(inObj._dedupWindow)), _winSize(move(inObj._winSize)), _winStep(move(inObj._winStep)) {};
 	/** \brief Move assignement operator
 	 *
 	 * \param[in] inObj object to be moved
@@ -161,6 +339,71 @@ public:
 	 * \param[in] newType new output format
 	 */
 	void changeOutType(const string &newType) {_outFileType = newType; };
+	/** \brief Switch output indexing
+	 *
+	 * If set to _true_, a BEDindex position index is saved to a _.bpi_ file after BED output is complete. Deduplicated output has no _.bed_ file to index, so no index is saved for it.
+	 *
+	 * \param[in] doIndex whether to index the output
+	 */
+	void indexOutput(const bool &doIndex) {_indexOut = doIndex; };
+	/** \brief Process a shard
+	 *
+	 * The reference is split into _nShards_ slices of (nearly) equal length and only slice _shard_ is processed. Slice boundaries depend only on the reference length, so separate processes given different shards cover the chromosome without overlap.
+	 * BED output is saved as fragments (e.g., _snp_Chr2L.s3of16.bed_, _.bim_ and _.fam_) with a self-describing header in place of the BED magic bytes. Fragments are combined with mergeShards(). Only BED output can be sharded.
+	 *
+	 * \param[in] shard shard index (0-based)
+	 * \param[in] nShards number of shards
+	 */
+	void setShard(const unsigned int &shard, const unsigned int &nShards);
+	/** \brief Switch genome-wide output
+	 *
+	 * If set to _true_, BED rows and _.bim_ lines are kept in memory rather than saved, so that several chromosomes processed in parallel can be saved to one file with saveGenomeBED().
+	 *
+	 * \param[in] genomeWide whether the output is genome-wide
+	 */
+	void genomeWide(const bool &genomeWide) {_genomeWide = genomeWide; };
+	/** \brief Switch checkpointing
+	 *
+	 * If set to _true_, a small checkpoint file (_.ckpt_) is saved next to the BED output after each chunk of the input files is done. It records the input offset, the number of SNPs and the lengths of the _.bed_ and _.bim_ files, together with a hash of the inputs.
+	 * If a matching checkpoint is found when the run starts, the output files are truncated to the recorded lengths and conversion continues from the recorded offset. The checkpoint is deleted when the run finishes. Checkpoints are not used for genome-wide output, which is kept in memory, or with window summaries, which need the full scan (a warning is printed).
+	 * The output files and the checkpoint are synchronized to disk (_fsync()_) before the checkpoint replaces the previous one, so a run can also be resumed after a node failure.
+	 *
+	 * \param[in] doCheckpoint whether to save checkpoints
+	 */
+	void checkpoint(const bool &doCheckpoint) {_checkpoint = doCheckpoint; };
+	/** \brief Switch incremental output
+	 *
+	 * If set to _true_, a site summary (_.sum_ file) is saved with the BED output. It records the first and second allele at every site, the runs of missing genotypes in each line, and the sizes and modification times of the input files.
+	 * When lines are later added to the end of the file list, the next run updates the existing output from the summary and the old BED rows, reading only the reference and the new lines. If the summary does not match (e.g., an old input file changed), all lines are converted again.
+	 * Incremental output cannot be sharded and is not resumed from checkpoints. It is ignored for genome-wide output.
+	 *
+	 * \param[in] incremental whether to keep the output updatable
+	 */
+	void incremental(const bool &incremental) {_incremental = incremental; };
+	/** \brief Switch VCF compression
+	 *
+	 * If the number of threads is not 0, VCF output is compressed in the BGZF format (_.vcf.gz_ file) by that many threads. Requires compilation with _USE_ZLIB_ (and linking to _zlib_).
+	 *
+	 * \param[in] nThreads number of compression threads
+	 */
+	void compressVCF(const unsigned int &nThreads) {_bgzfThreads = nThreads; };
+	/** \brief Switch BED row deduplication
+	 *
+	 * If the window is not 0, BED output is saved deduplicated (see BEDdedup): unique rows go to a _.dbed_ file and the pattern of each SNP to a _.pid_ file, while the _.bim_ and _.fam_ files are as usual. No _.bpi_ index is saved, and _.bed_, _.bpi_, _.sum_ and _.ckpt_ files left from an earlier ordinary run are removed; ordinary output likewise removes old _.dbed_ and _.pid_ files. A row matches an earlier one if that row was last seen no more than _window_ SNPs before.
+	 * Deduplication cannot be combined with sharding or incremental output, does not use checkpoints, and is ignored for genome-wide output.
+	 *
+	 * \param[in] window window size in SNPs; 0 to switch deduplication off
+	 */
+	void dedupBED(const uint32_t &window) {_dedupWindow = window; };
+	/** \brief Switch window summaries
+	 *
+	 * If the window size is not 0, per-window statistics are collected while BED or VCF output is made and saved to a _.win_ file (see WindowStats). Windows of _winSize_ bases start every _step_ bases; _winSize_ must be a multiple of _step_, and the two are equal for non-overlapping windows.
+	 * Window summaries cannot be combined with sharding or incremental output and turn off checkpoint resumption.
+	 *
+	 * \param[in] winSize window size in bases; 0 to switch summaries off
+	 * \param[in] step distance between window starts in bases
+	 */
+	void windowStats(const uint32_t &winSize, const uint32_t &step) {_winSize = winSize; _winStep = step; };
 	
 	/** \brief Input file parsing
 	 *
@@ -168,9 +411,600 @@ public:
 	 *
 	 */
 	void operator()();
+	/** \brief Stream SNPs
+	 *
+	 * Scans the input files for biallelic SNPs, as for BED output, but instead of saving them passes each SNP to the visitor. Nothing is written to disk. Shard settings are respected.
+	 *
+	 * \param[in,out] visitor SNP visitor
+	 */
+	void operator()(SNPvisitor &visitor);
+	/** \brief Input size
+	 *
+	 * \return total size of the reference and line files in bytes
+	 */
+	uint64_t inputSize() const;
+	
+	friend void saveGenomeBED(vector<SFparse> &parsers, const string &outFlNam);
+	friend class SNPserver;
+};
+
+/** \brief BED writer
+ *
+ * SNP visitor that saves packed BED rows and _.bim_ lines, either to output streams or to memory. Does not write the BED magic bytes or the _.fam_ file.
+ */
+class BEDwriter : public SNPvisitor {
+private:
+	/// BED output stream
+	ostream *_bedOut;
+	/// _.bim_ output stream
+	ostream *_bimOut;
+	/// BED rows in memory
+	vector<char> *_bedRows;
+	/// _.bim_ lines in memory
+	string *_bimRows;
+	/// Chromosome number
+	unsigned short _chromNum;
+	/// Chromosome name
+	string _chromName;
+	/// Number of SNPs saved
+	uint64_t _nSNP;
+	
+public:
+	/** \brief Constructor with output streams
+	 *
+	 * \param[in] bedOut BED output stream
+	 * \param[in] bimOut _.bim_ output stream
+	 * \param[in] chrNum chromosome number
+	 * \param[in] chrName chromosome name
+	 */
+	BEDwriter(ostream &bedOut, ostream &bimOut, const unsigned short &chrNum, const string &chrName);
+	/** \brief Constructor with memory output
+	 *
+	 * BED rows and _.bim_ lines are appended to the provided objects.
+	 *
+	 * \param[in] bedRows BED rows
+	 * \param[in] bimRows _.bim_ lines
+	 * \param[in] chrNum chromosome number
+	 * \param[in] chrName chromosome name
+	 */
+	BEDwriter(vector<char> &bedRows, string &bimRows, const unsigned short &chrNum, const string &chrName);
+	
+	/// Destructor
+	~BEDwriter(){};
+	
+	/** \brief Save a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec);
+	/** \brief Number of SNPs
+	 *
+	 * \return number of SNPs saved so far
+	 */
+	uint64_t nSNP() const {return _nSNP; };
+};
+
+/** \brief VCF writer
+ *
+ * SNP visitor that saves SNPs in the VCF format, with the same SNP IDs and alleles as in the _.bim_ files. Genotypes are saved as homozygotes (_0/0_, _1/1_, or _./._ if missing). The ancestral allele is in the _AA_ INFO field, and the _m_/_d_ tag in the _TAG_ field.
+ * Records are formatted directly into a large buffer. Genotype fields are copied from a table indexed by nucleotide, in which only the alternative allele entry changes between SNPs.
+ * The output can be compressed in the BGZF format, with the blocks in each full buffer compressed in parallel. Compression requires compilation with _USE_ZLIB_.
+ */
+class VCFwriter : public SNPvisitor {
+private:
+	/// VCF output stream
+	ostream *_vcfOut;
+	/// Chromosome name
+	string _chromName;
+	/// Output buffer
+	vector<char> _buffer;
+	/// Number of bytes used in the buffer
+	size_t _fill;
+	/// Genotype fields (tab and genotype) for each nucleotide
+	char _genoTable[256][4];
+	/// Number of BGZF compression threads; 0 for plain text
+	unsigned int _nThreads;
+	/// Number of SNPs saved
+	uint64_t _nSNP;
+	
+	/** \brief Make room in the buffer
+	 *
+	 * Saves the buffer contents if fewer than _nBytes_ bytes are free, and grows the buffer if it is still too small.
+	 *
+	 * \param[in] nBytes number of bytes needed
+	 */
+	void _reserve(const size_t &nBytes);
+	/// Save the buffer contents
+	void _flush();
+	
+public:
+	/** \brief Constructor
+	 *
+	 * Puts the VCF header in the buffer.
+	 *
+	 * \param[in] vcfOut VCF output stream
+	 * \param[in] lineNames line names
+	 * \param[in] chrName chromosome name
+	 * \param[in] nThreads number of BGZF compression threads; 0 for uncompressed output
+	 */
+	VCFwriter(ostream &vcfOut, const vector<string> &lineNames, const string &chrName, const unsigned int &nThreads = 0);
+	
+	/// Destructor
+	~VCFwriter(){};
+	
+	/** \brief Save a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec);
+	/** \brief Finish the output
+	 *
+	 * Saves the buffered records and, for compressed output, the BGZF end-of-file block. Must be called once all SNPs are saved.
+	 */
+	void finish();
+	/** \brief Number of SNPs
+	 *
+	 * \return number of SNPs saved so far
+	 */
+	uint64_t nSNP() const {return _nSNP; };
+};
+
+/** \brief Window summaries
+ *
+ * SNP visitor that collects diversity and missingness statistics in windows along the chromosome. For each window it counts the sites, the sites where the outgroup (reference) is known, and the biallelic SNPs; for each line it records the fraction of missing sites and the divergence from the outgroup (fraction of sites, among those where both the line and the outgroup are known, at which they differ).
+ * Counts are accumulated in step-sized bins, one array of per-line counters after another, and windows are assembled from consecutive bins when the table is saved.
+ */
+class WindowStats : public SNPvisitor {
+private:
+	/// Line names
+	vector<string> _lineNames;
+	/// Chromosome name
+	string _chromName;
+	/// Window size in bases
+	uint32_t _winSize;
+	/// Window step (bin size) in bases
+	uint32_t _step;
+	/// Number of sites in each bin
+	vector<uint32_t> _binSites;
+	/// Number of sites with a known outgroup state in each bin
+	vector<uint32_t> _binOutgroup;
+	/// Number of SNPs in each bin
+	vector<uint32_t> _binSNP;
+	/// Missing sites for each line, bin by bin
+	vector<uint32_t> _binMissing;
+	/// Sites where the line and the outgroup are both known, bin by bin
+	vector<uint32_t> _binCalled;
+	/// Sites where the line differs from the known outgroup, bin by bin
+	vector<uint32_t> _binDivergent;
+	
+public:
+	/** \brief Constructor
+	 *
+	 * \param[in] lineNames line names
+	 * \param[in] chrName chromosome name
+	 * \param[in] winSize window size in bases
+	 * \param[in] step distance between window starts in bases; must divide _winSize_
+	 */
+	WindowStats(const vector<string> &lineNames, const string &chrName, const uint32_t &winSize, const uint32_t &step);
+	
+	/// Destructor
+	~WindowStats(){};
+	
+	/** \brief Count a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec);
+	/** \brief Count sites
+	 *
+	 * \param[in] refBuf reference (ancestral) sequence
+	 * \param[in] seqBufs sequences of the lines
+	 * \param[in] nLines number of lines
+	 * \param[in] nSites number of sites in the chunk
+	 * \param[in] offset zero-based position of the first site
+	 */
+	void sites(const char *refBuf, const char * const *seqBufs, const size_t &nLines, const size_t &nSites, const size_t &offset);
+	/** \brief Save the window table
+	 *
+	 * Saves a tab-delimited table with a header. Each row has the chromosome, 1-based start and end of the window, number of sites, outgroup-known sites and SNPs, followed by the missing fraction (_miss__ columns) and outgroup divergence (_div__ columns) of each line. Divergence is _NA_ if the line and outgroup are never both known in the window.
+	 *
+	 * \param[in] outFlNam output file name
+	 */
+	void save(const string &outFlNam) const;
+};
+
+/** \brief Deduplicating BED writer
+ *
+ * SNP visitor that saves each distinct BED row once. Rows are looked up in a hash table of the rows seen within a window of recent SNPs; a row that matches gets the pattern ID of the earlier row, otherwise it is saved as a new pattern. The _.bim_ lines of all SNPs are saved as by BEDwriter.
+ * Unique rows are written to the pattern stream, which should start with the BED magic bytes, so that the pattern file is itself a valid BED file with one row per pattern. Pattern IDs are kept in memory and saved with savePatternIndex().
+ *
+ * The binary _.pid_ file layout is: the "A2BP" tag, format version (32 bit), number of SNPs and number of patterns (64 bit), BED row length (64 bit), window size (32 bit), followed by the pattern ID of each SNP (32 bit).
+ */
+class BEDdedup : public SNPvisitor {
+private:
+	/// Pattern (unique row) output stream
+	ostream *_patternOut;
+	/// _.bim_ output stream
+	ostream *_bimOut;
+	/// Chromosome number
+	unsigned short _chromNum;
+	/// Chromosome name
+	string _chromName;
+	/// Window size in SNPs
+	uint32_t _window;
+	/// A recently seen row
+	struct RecentRow {
+		/// Packed BED row
+		string row;
+		/// Pattern ID
+		uint32_t patternID;
+		/// Index of the last SNP with this row
+		uint64_t lastSNP;
+	};
+	/// Recently seen rows by hash
+	unordered_map<uint64_t, RecentRow> _recent;
+	/// Pattern ID of each SNP
+	vector<uint32_t> _patternIDs;
+	/// Number of patterns saved
+	uint32_t _nPatterns;
+	/// BED row length
+	uint64_t _rowLength;
+	
+public:
+	/** \brief Constructor
+	 *
+	 * \param[in] patternOut unique row output stream
+	 * \param[in] bimOut _.bim_ output stream
+	 * \param[in] chrNum chromosome number
+	 * \param[in] chrName chromosome name
+	 * \param[in] window window size in SNPs
+	 */
+	BEDdedup(ostream &patternOut, ostream &bimOut, const unsigned short &chrNum, const string &chrName, const uint32_t &window);
+	
+	/// Destructor
+	~BEDdedup(){};
+	
+	/** \brief Save a SNP
+	 *
+	 * \param[in] rec SNP record
+	 */
+	void snp(const SNPrecord &rec);
+	/** \brief Save the pattern index
+	 *
+	 * \param[in] pidFlNam _.pid_ file name
+	 */
+	void savePatternIndex(const string &pidFlNam) const;
+	/** \brief Number of SNPs
+	 *
+	 * \return number of SNPs saved so far
+	 */
+	uint64_t nSNP() const {return _patternIDs.size(); };
+	/** \brief Number of patterns
+	 *
+	 * \return number of unique rows saved so far
+	 */
+	uint32_t nPatterns() const {return _nPatterns; };
+};
+
+/** \brief Deduplicated BED reader
+ *
+ * Loads the unique rows (_.dbed_ file) and the pattern index (_.pid_ file) saved by BEDdedup. Gives access to the row of any SNP and to the pattern of each SNP, so that analyses can be run once per pattern, and can expand the data back to an ordinary BED file.
+ */
+class BEDpatterns {
+private:
+	/// Unique BED rows, without the magic bytes
+	vector<char> _patterns;
+	/// Pattern ID of each SNP
+	vector<uint32_t> _patternIDs;
+	/// BED row length
+	uint64_t _rowLength;
+	
+public:
+	/// Default constructor
+	BEDpatterns() : _rowLength(0) {};
+	/** \brief Constructor
+	 *
+	 * \param[in] dbedFlNam unique row (_.dbed_) file name
+	 * \param[in] pidFlNam pattern index (_.pid_) file name
+	 */
+	BEDpatterns(const string &dbedFlNam, const string &pidFlNam);
+	
+	/// Destructor
+	~BEDpatterns(){};
+	
+	/** \brief Number of SNPs
+	 *
+	 * \return number of SNPs
+	 */
+	uint64_t nSNP() const {return _patternIDs.size(); };
+	/** \brief Number of patterns
+	 *
+	 * \return number of unique rows
+	 */
+	uint64_t nPatterns() const {return (_rowLength ? _patterns.size()/_rowLength : 0); };
+	/** \brief BED row length
+	 *
+	 * \return number of bytes per row
+	 */
+	uint64_t rowLength() const {return _rowLength; };
+	/** \brief Pattern of a SNP
+	 *
+	 * \param[in] iSNP SNP index (_.bim_ line)
+	 *
+	 * \return pattern ID
+	 */
+	uint32_t patternID(const uint64_t &iSNP) const {return _patternIDs[iSNP]; };
+	/** \brief Row of a pattern
+	 *
+	 * \param[in] iPattern pattern ID
+	 *
+	 * \return pointer to the packed BED row
+	 */
+	const char* pattern(const uint32_t &iPattern) const {return _patterns.data() + iPattern*_rowLength; };
+	/** \brief Row of a SNP
+	 *
+	 * \param[in] iSNP SNP index (_.bim_ line)
+	 *
+	 * \return pointer to the packed BED row
+	 */
+	const char* row(const uint64_t &iSNP) const {return pattern(_patternIDs[iSNP]); };
+	/** \brief Expand to a BED file
+	 *
+	 * Saves every SNP row, in _.bim_ order, to an ordinary BED file.
+	 *
+	 * \param[in] outFlNam output BED file name
+	 */
+	void expand(const string &outFlNam) const;
+};
+
+/** \brief Merge shard fragments
+ *
+ * Combines BED fragments saved by sharded SFparse runs into a single _plink_ BED data set. Fragments can come from several chromosomes; chromosomes are saved in the order they first appear in the list and fragments within each chromosome are sorted by shard.
+ * Fragment headers are checked for completeness, matching numbers of lines, a full shard series per chromosome, and position continuity between consecutive shards. The _.fam_ files must be identical. Data are copied byte for byte, without re-encoding.
+ *
+ * \param[in] fragNames names of the BED fragment files
+ * \param[in] outFlNam output BED file name
+ */
+void mergeShards(const vector<string> &fragNames, const string &outFlNam);
+
+/** \brief Save a genome-wide BED file
+ *
+ * Saves the output of several SFparse objects (typically one per chromosome) run with genome-wide output switched on to one _plink_ BED data set, in the order of the _parsers_ vector.
+ * An exclusive prefix sum of the SNP counts gives each object its row offset. The BED file is allocated at full size and the rows are then written in parallel, one thread per object, with _pwrite()_ at their offsets. The _.bim_ lines are concatenated in order.
+ * All objects must have the same lines. The memory held by each object is released once its rows are saved.
+ *
+ * \param[in,out] parsers objects with genome-wide output
+ * \param[in] outFlNam output BED file name
+ */
+void saveGenomeBED(vector<SFparse> &parsers, const string &outFlNam);
+
+/** \brief Range of rows in a BED file
+ *
+ * Rows (SNPs) matching a query, with the corresponding byte ranges in the _.bed_ and _.bim_ files. Byte ranges are half-open, so the number of bytes is end minus begin.
+ */
+struct BEDrange {
+	/// Index of the first row
+	uint64_t firstRow;
+	/// Number of rows
+	uint64_t nRows;
+	/// Beginning of the rows in the _.bed_ file
+	uint64_t bedBegin;
+	/// End of the rows in the _.bed_ file
+	uint64_t bedEnd;
+	/// Beginning of the lines in the _.bim_ file
+	uint64_t bimBegin;
+	/// End of the lines in the _.bim_ file
+	uint64_t bimEnd;
+};
+
+/** \brief Position index for BED files
+ *
+ * Sorted SNP positions and _.bim_ line offsets for each chromosome in a SNP-major BED file. Region queries take logarithmic time and return the byte ranges of the matching rows in the _.bed_ and _.bim_ files, so they can be read without scanning either file.
+ * Chromosome names are taken from SNP names (the part after the last underscore, as in _align2bed_ output) or from the first _.bim_ column if the SNP name has no underscore. Rows of each chromosome must be contiguous and sorted by position.
+ *
+ * The binary _.bpi_ file layout is: the "A2BI" tag, format version (32 bit), number of SNPs and number of lines (64 bit), number of chromosomes (32 bit), then for each chromosome name length (32 bit), name, first row and row count (64 bit). These are followed by the positions (32 bit) and the _.bim_ line offsets (64 bit, one more than the number of SNPs).
+ */
+class BEDindex {
+private:
+	/// Chromosome names
+	vector<string> _chrNames;
+	/// First row of each chromosome
+	vector<uint64_t> _chrFirst;
+	/// Number of rows in each chromosome
+	vector<uint64_t> _chrCount;
+	/// SNP positions
+	vector<uint32_t> _positions;
+	/// Offsets of _.bim_ lines; the last element is the size of the _.bim_ file
+	vector<uint64_t> _bimOffsets;
+	/// Number of lines (individuals)
+	uint64_t _nLines;
+	/// Number of bytes per BED row
+	uint64_t _bedLineLen;
 	
+public:
+	/// Default constructor
+	BEDindex() : _nLines(0), _bedLineLen(0) {};
+	/** \brief Constructor from a _.bpi_ file
+	 *
+	 * Loads a previously saved index.
+	 *
+	 * \param[in] indexFlNam index file name
+	 */
+	BEDindex(const string &indexFlNam);
+	/** \brief Constructor from _plink_ metadata files
+	 *
+	 * Builds the index by scanning the _.bim_ file. The _.fam_ file is used to get the number of lines, and thus the BED row length.
+	 *
+	 * \param[in] bimFlNam _.bim_ file name
+	 * \param[in] famFlNam _.fam_ file name
+	 */
+	BEDindex(const string &bimFlNam, const string &famFlNam);
+	
+	/// Destructor
+	~BEDindex(){};
+	
+	/** \brief Save the index
+	 *
+	 * \param[in] outFlNam output file name
+	 */
+	void save(const string &outFlNam) const;
+	/** \brief Region query
+	 *
+	 * Finds SNPs with positions between _start_ and _end_ (inclusive) on a chromosome. If the chromosome is not in the index, or there are no SNPs in the region, the returned range has no rows.
+	 *
+	 * \param[in] chrom chromosome name
+	 * \param[in] start first position
+	 * \param[in] end last position
+	 *
+	 * \return range of matching rows
+	 */
+	BEDrange query(const string &chrom, const uint32_t &start, const uint32_t &end) const;
+	/** \brief Number of SNPs
+	 *
+	 * \return number of indexed SNPs
+	 */
+	uint64_t nSNP() const {return _positions.size(); };
 };
 
+/** \brief NUMA node layout
+ *
+ * CPUs of each NUMA node the process may run on. The layout comes from _libnuma_ if compiled with _USE_LIBNUMA_ and from _/sys/devices/system/node_ otherwise. Without NUMA information, all available CPUs form a single node.
+ * A thread pinned to a node with pin() before it allocates its buffers gets them from the memory of that node under the default first-touch policy. SFparse allocates its chunk buffers in the thread that runs the conversion.
+ * Thread affinity is only available on Linux; elsewhere there is a single node and pin() always fails.
+ */
+class NUMAlayout {
+private:
+	/// CPUs of each node
+	vector< vector<int> > _nodeCPUs;
+	/// System IDs of the nodes
+	vector<int> _nodeIDs;
+	/// CPUs the process was allowed to run on when the layout was discovered
+	vector<int> _startCPUs;
+	
+public:
+	/** \brief Default constructor
+	 *
+	 * Discovers the node layout.
+	 */
+	NUMAlayout();
+	
+	/// Destructor
+	~NUMAlayout(){};
+	
+	/** \brief Number of nodes
+	 *
+	 * \return number of nodes with available CPUs
+	 */
+	size_t nNodes() const {return _nodeCPUs.size(); };
+	/** \brief Node ID
+	 *
+	 * \param[in] iNode node index
+	 *
+	 * \return system ID of the node
+	 */
+	int nodeID(const size_t &iNode) const {return _nodeIDs[iNode]; };
+	/** \brief Pin the calling thread
+	 *
+	 * Restricts the calling thread to the CPUs of a node and, with _libnuma_, sets its memory policy to local allocation.
+	 *
+	 * \param[in] iNode node index
+	 *
+	 * \return _true_ if successful
+	 */
+	bool pin(const size_t &iNode) const;
+	/** \brief Unpin the calling thread
+	 *
+	 * Restores the CPU affinity the process had when the layout was discovered, so that threads started later by the calling thread are not confined to its last node.
+	 *
+	 * \return _true_ if successful
+	 */
+	bool unpin() const;
+};
 
 
+/** \brief SNP extraction server
+ *
+ * Keeps the alignments of several chromosomes memory-mapped and answers region and line subset requests over a Unix domain socket, so that repeated extractions do not re-read the _.seq_ files.
+ * Each request is one line of text:
+ *
+ *     region chrom start end [line1,line2,...]
+ *
+ * Positions are 1-based and inclusive. SNPs are called among the listed lines only (all lines if there is no list), as in a BED conversion of that subset. The reply is a line "OK nSNP bedBytes bimBytes famBytes" followed by the _.bed_ (with the magic bytes), _.bim_ and _.fam_ data, or a line starting with "ERROR".
+ * The request "shutdown" stops the server. Each connection is answered by its own thread, up to 64 at a time. A client that does not send its whole request within 30 seconds gets an error reply, so it cannot hold up the others.
+ */
+class SNPserver {
+private:
+	/// Chromosome names
+	vector<string> _chromNames;
+	/// Chromosome numbers
+	vector<unsigned short> _chromNums;
+	/// Line names for each chromosome
+	vector< vector<string> > _lineNames;
+	/// Mapped reference sequences
+	vector<const char*> _refSeqs;
+	/// Mapped line sequences for each chromosome
+	vector< vector<const char*> > _lineSeqs;
+	/// Sequence length of each chromosome
+	vector<size_t> _seqLengths;
+	/// Mapped regions, to unmap at the end
+	vector< pair<void*, size_t> > _maps;
+	
+	/** \brief Map a sequence file
+	 *
+	 * Compressed files are decompressed into anonymous memory.
+	 *
+	 * \param[in] flName file name
+	 * \param[out] flSize file size (uncompressed)
+	 *
+	 * \return pointer to the mapped file
+	 */
+	const char* _map(const string &flName, size_t &flSize);
+	/** \brief Answer a request
+	 *
+	 * \param[in] request request line
+	 * \param[out] reply reply header and data
+	 *
+	 * \return _false_ if the request is to shut down
+	 */
+	bool _answer(const string &request, string &reply) const;
+	
+public:
+	/// Default constructor
+	SNPserver(){};
+	/** \brief Constructor
+	 *
+	 * Maps the reference and line files of each parser. The file lists, line and chromosome names are taken from the parsers; output settings are ignored. All line sequences must be at least as long as the reference.
+	 *
+	 * \param[in] parsers parsers, one per chromosome
+	 */
+	SNPserver(const vector<SFparse> &parsers);
+	/// Copy constructor (deleted)
+	SNPserver(const SNPserver &inObj) = delete;
+	/// Copy assignment (deleted)
+	SNPserver& operator=(const SNPserver &inObj) = delete;
+	
+	/// Destructor
+	~SNPserver();
+	
+	/** \brief Serve requests
+	 *
+	 * Listens on a Unix domain socket until a "shutdown" request arrives. An existing socket file is replaced.
+	 *
+	 * \param[in] socketPath socket file name
+	 */
+	void serve(const string &socketPath) const;
+};
+
+/** \brief Request SNPs from a server
+ *
+ * Sends a request to an SNPserver and saves the reply as _outBase.bed_, _outBase.bim_ and _outBase.fam_. Nothing is saved if _outBase_ is empty.
+ *
+ * \param[in] socketPath server socket file name
+ * \param[in] request request line, without the end of line
+ * \param[in] outBase output file name minus extension
+ *
+ * \return number of SNPs received
+ */
+uint64_t requestSNPs(const string &socketPath, const string &request, const string &outBase);
+
 #endif /* sequence_hpp */